@@ -19,8 +19,10 @@
 #include "core/MapVec.h"
 #include "core/TileData.h"
 
+#include "datasources/ArchiveTileDataSource.h"
 #include "datasources/AssetTileDataSource.h"
 #include "datasources/BitmapOverlayRasterTileDataSource.h"
+#include "datasources/CoalescingTileDataSource.h"
 #include "datasources/HTTPTileDataSource.h"
 #include "datasources/MBTilesTileDataSource.h"
 #include "datasources/NutiteqOnlineTileDataSource.h"
@@ -28,6 +30,7 @@
 #include "datasources/OnlineNMLModelLODTreeDataSource.h"
 #include "datasources/SqliteNMLModelLODTreeDataSource.h"
 #include "datasources/PersistentCacheTileDataSource.h"
+#include "datasources/PooledMBTilesTileDataSource.h"
 #include "datasources/LocalVectorDataSource.h"
 #include "datasources/OGRVectorDataSource.h"
 #include "datasources/GDALRasterTileDataSource.h"
@@ -95,6 +98,7 @@
 #include "ui/VectorElementsClickInfo.h"
 
 #include "utils/AssetUtils.h"
+#include "utils/TileArchiveUtils.h"
 #include "utils/BitmapUtils.h"
 #include "utils/Const.h"
 #include "utils/Log.h"
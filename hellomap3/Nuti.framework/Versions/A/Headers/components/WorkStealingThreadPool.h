@@ -0,0 +1,311 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_WORKSTEALINGTHREADPOOL_H_
+#define _NUTI_WORKSTEALINGTHREADPOOL_H_
+
+#include "CancelableTask.h"
+#include "components/ThreadWorker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Nuti {
+
+    // Thread pool with the same interface as CancelableThreadPool, but tasks are spread over separately locked
+    // priority queues, so submission and cancelation do not contend on a single lock. A worker takes the highest
+    // priority task from its own queue and steals the head of another queue only when its own queue is empty,
+    // so priorities (and submission order for equal priorities) are only guaranteed within a single queue.
+    class WorkStealingThreadPool : public std::enable_shared_from_this<WorkStealingThreadPool> {
+    public:
+        WorkStealingThreadPool();
+        virtual ~WorkStealingThreadPool();
+        void deinit();
+
+        int getPoolSize() const;
+        void setPoolSize(int threadCount);
+
+        void execute(std::shared_ptr<CancelableTask>);
+        void execute(std::shared_ptr<CancelableTask>, int priority);
+
+        void cancelAll();
+
+    private:
+        struct TaskRecord {
+            TaskRecord(std::shared_ptr<CancelableTask> task, int priority, long long sequence);
+
+            bool operator <(const TaskRecord& taskRecord) const;
+
+            std::shared_ptr<CancelableTask> _task;
+            int _priority;
+            long long _sequence;
+        };
+
+        struct TaskQueue {
+            TaskQueue();
+
+            void push(const TaskRecord& record);
+            std::shared_ptr<CancelableTask> pop();
+            int cancelAll();
+
+            std::vector<TaskRecord> _taskRecords; // binary heap, highest priority first
+            mutable std::mutex _mutex;
+        };
+
+        struct TaskWorker : public ThreadWorker {
+            TaskWorker(const std::shared_ptr<WorkStealingThreadPool>& threadPool, int index);
+
+            void operator()();
+
+            std::shared_ptr<WorkStealingThreadPool> _threadPool;
+            int _index;
+            bool _running;
+        };
+
+        typedef std::vector<std::shared_ptr<TaskWorker> > WorkerList;
+        typedef std::vector<std::shared_ptr<std::thread> > ThreadList;
+
+        std::shared_ptr<CancelableTask> getNextTask(int index);
+
+        bool waitForTask(TaskWorker& worker);
+
+        static const int DEFAULT_PRIORITY = 0;
+        static const int MAX_POOL_SIZE = 32;
+
+        std::atomic<int> _poolSize;
+        std::atomic<long long> _taskCount;
+        std::atomic<int> _pendingCount;
+        std::atomic<unsigned int> _nextQueue;
+        std::atomic<int> _usedQueueCount; // queues above this index have never been used
+
+        bool _stop;
+
+        std::unique_ptr<TaskQueue[]> _queues;
+        WorkerList _workers;
+        ThreadList _threads;
+
+        mutable std::mutex _mutex; // guards worker creation, termination and sleeping
+        std::condition_variable _condition;
+    };
+
+    inline WorkStealingThreadPool::WorkStealingThreadPool() :
+        _poolSize(0),
+        _taskCount(0),
+        _pendingCount(0),
+        _nextQueue(0),
+        _usedQueueCount(0),
+        _stop(false),
+        _queues(new TaskQueue[MAX_POOL_SIZE]),
+        _workers(),
+        _threads(),
+        _mutex(),
+        _condition()
+    {
+    }
+
+    inline WorkStealingThreadPool::~WorkStealingThreadPool() {
+    }
+
+    inline void WorkStealingThreadPool::deinit() {
+        cancelAll();
+
+        ThreadList threads;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _condition.notify_all();
+            threads.swap(_threads);
+            _workers.clear();
+        }
+
+        for (const std::shared_ptr<std::thread>& thread : threads) {
+            if (thread->get_id() == std::this_thread::get_id()) {
+                thread->detach();
+            } else if (thread->joinable()) {
+                thread->join();
+            }
+        }
+    }
+
+    inline int WorkStealingThreadPool::getPoolSize() const {
+        return _poolSize.load();
+    }
+
+    inline void WorkStealingThreadPool::setPoolSize(int threadCount) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stop) {
+            return;
+        }
+
+        threadCount = std::max(0, std::min(threadCount, static_cast<int>(MAX_POOL_SIZE)));
+        _poolSize = threadCount;
+        _workers.resize(std::max(_workers.size(), static_cast<std::size_t>(threadCount)));
+        _threads.resize(_workers.size());
+
+        // Start workers for empty slots and for slots whose worker has already terminated
+        for (int i = 0; i < threadCount; i++) {
+            if (_workers[i] && _workers[i]->_running) {
+                continue;
+            }
+            if (_threads[i] && _threads[i]->joinable()) {
+                _threads[i]->join();
+            }
+            std::shared_ptr<TaskWorker> worker = std::make_shared<TaskWorker>(shared_from_this(), i);
+            _workers[i] = worker;
+            _threads[i] = std::make_shared<std::thread>([worker]() { (*worker)(); });
+        }
+
+        // Workers above the new size terminate once they become idle
+        _condition.notify_all();
+    }
+
+    inline void WorkStealingThreadPool::execute(std::shared_ptr<CancelableTask> task) {
+        execute(task, DEFAULT_PRIORITY);
+    }
+
+    inline void WorkStealingThreadPool::execute(std::shared_ptr<CancelableTask> task, int priority) {
+        int poolSize = std::max(1, _poolSize.load());
+        int queueIndex = static_cast<int>(_nextQueue++ % poolSize);
+        int usedQueueCount = _usedQueueCount.load();
+        while (usedQueueCount <= queueIndex && !_usedQueueCount.compare_exchange_weak(usedQueueCount, queueIndex + 1)) {
+        }
+        _queues[queueIndex].push(TaskRecord(task, priority, _taskCount++));
+        _pendingCount++;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _condition.notify_one();
+    }
+
+    inline void WorkStealingThreadPool::cancelAll() {
+        int usedQueueCount = _usedQueueCount.load();
+        for (int i = 0; i < usedQueueCount; i++) {
+            _pendingCount -= _queues[i].cancelAll();
+        }
+    }
+
+    inline WorkStealingThreadPool::TaskRecord::TaskRecord(std::shared_ptr<CancelableTask> task, int priority, long long sequence) :
+        _task(task),
+        _priority(priority),
+        _sequence(sequence)
+    {
+    }
+
+    inline bool WorkStealingThreadPool::TaskRecord::operator <(const TaskRecord& taskRecord) const {
+        if (_priority != taskRecord._priority) {
+            return _priority < taskRecord._priority;
+        }
+        return _sequence > taskRecord._sequence;
+    }
+
+    inline WorkStealingThreadPool::TaskQueue::TaskQueue() :
+        _taskRecords(),
+        _mutex()
+    {
+    }
+
+    inline void WorkStealingThreadPool::TaskQueue::push(const TaskRecord& record) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _taskRecords.push_back(record);
+        std::push_heap(_taskRecords.begin(), _taskRecords.end());
+    }
+
+    inline std::shared_ptr<CancelableTask> WorkStealingThreadPool::TaskQueue::pop() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_taskRecords.empty()) {
+            return std::shared_ptr<CancelableTask>();
+        }
+        std::pop_heap(_taskRecords.begin(), _taskRecords.end());
+        std::shared_ptr<CancelableTask> task = _taskRecords.back()._task;
+        _taskRecords.pop_back();
+        return task;
+    }
+
+    inline int WorkStealingThreadPool::TaskQueue::cancelAll() {
+        std::vector<TaskRecord> taskRecords;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            taskRecords.swap(_taskRecords);
+        }
+
+        // Cancel outside of the queue lock, tasks may resubmit from their cancel handlers
+        for (const TaskRecord& record : taskRecords) {
+            record._task->cancel();
+        }
+        return static_cast<int>(taskRecords.size());
+    }
+
+    inline WorkStealingThreadPool::TaskWorker::TaskWorker(const std::shared_ptr<WorkStealingThreadPool>& threadPool, int index) :
+        _threadPool(threadPool),
+        _index(index),
+        _running(true)
+    {
+    }
+
+    inline void WorkStealingThreadPool::TaskWorker::operator()() {
+        while (true) {
+            if (std::shared_ptr<CancelableTask> task = _threadPool->getNextTask(_index)) {
+                if (!task->isCanceled()) {
+                    (*task)();
+                }
+                continue;
+            }
+
+            if (!_threadPool->waitForTask(*this)) {
+                break;
+            }
+        }
+        _threadPool.reset();
+    }
+
+    inline std::shared_ptr<CancelableTask> WorkStealingThreadPool::getNextTask(int index) {
+        if (index >= _poolSize.load()) {
+            return std::shared_ptr<CancelableTask>();
+        }
+
+        // Own queue first, so a busy pool locks only one queue per task
+        if (std::shared_ptr<CancelableTask> task = _queues[index].pop()) {
+            _pendingCount--;
+            return task;
+        }
+
+        // Steal from the other queues (including queues of terminated workers), starting from the next queue
+        int usedQueueCount = _usedQueueCount.load();
+        for (int i = 0; i < usedQueueCount && _pendingCount.load() > 0; i++) {
+            int queueIndex = (index + 1 + i) % usedQueueCount;
+            if (queueIndex == index) {
+                continue;
+            }
+            if (std::shared_ptr<CancelableTask> task = _queues[queueIndex].pop()) {
+                _pendingCount--;
+                return task;
+            }
+        }
+        return std::shared_ptr<CancelableTask>();
+    }
+
+    inline bool WorkStealingThreadPool::waitForTask(TaskWorker& worker) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            if (_stop || worker._index >= _poolSize.load()) {
+                worker._running = false;
+                return false;
+            }
+            if (_pendingCount.load() > 0) {
+                return true;
+            }
+            _condition.wait(lock);
+        }
+    }
+
+}
+
+#endif
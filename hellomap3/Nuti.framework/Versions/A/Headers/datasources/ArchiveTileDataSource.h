@@ -0,0 +1,68 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_ARCHIVETILEDATASOURCE_H_
+#define _NUTI_ARCHIVETILEDATASOURCE_H_
+
+#include "datasources/TileDataSource.h"
+#include "utils/Log.h"
+#include "utils/TileArchive.h"
+
+#include <string>
+
+namespace Nuti {
+
+    /**
+     * A tile data source that loads tiles from a local tile archive.
+     * Tile lookups do not take any locks, so tiles can be loaded from all tile threads in parallel.
+     * The tile bytes are read from the file directly into the returned tile data.
+     * Archives can be created from MBTiles databases and downloaded packages using TileArchiveUtils.
+     */
+    class ArchiveTileDataSource : public TileDataSource {
+    public:
+        /**
+         * Constructs an ArchiveTileDataSource object. Min and max zoom levels are read from the archive.
+         * @param path The path to the local tile archive file.
+         */
+        ArchiveTileDataSource(const std::string& path);
+        virtual ~ArchiveTileDataSource();
+
+        virtual std::shared_ptr<TileData> loadTile(const MapTile& mapTile);
+
+    private:
+        ArchiveTileDataSource(const std::shared_ptr<TileArchive>& archive, const std::string& path);
+
+        std::shared_ptr<TileArchive> _archive;
+    };
+
+    inline ArchiveTileDataSource::ArchiveTileDataSource(const std::string& path) :
+        ArchiveTileDataSource(TileArchive::Open(path), path)
+    {
+    }
+
+    inline ArchiveTileDataSource::ArchiveTileDataSource(const std::shared_ptr<TileArchive>& archive, const std::string& path) :
+        TileDataSource(archive ? archive->getMinZoom() : 0, archive ? archive->getMaxZoom() : 0),
+        _archive(archive)
+    {
+        if (!_archive) {
+            Log::Errorf("ArchiveTileDataSource: Failed to open tile archive %s", path.c_str());
+        }
+    }
+
+    inline ArchiveTileDataSource::~ArchiveTileDataSource() {
+    }
+
+    inline std::shared_ptr<TileData> ArchiveTileDataSource::loadTile(const MapTile& mapTile) {
+        auto data = std::make_shared<std::vector<unsigned char> >();
+        if (!_archive || !_archive->findTile(mapTile.getZoom(), mapTile.getX(), mapTile.getY(), *data)) {
+            return std::shared_ptr<TileData>();
+        }
+        return std::make_shared<TileData>(data);
+    }
+
+}
+
+#endif
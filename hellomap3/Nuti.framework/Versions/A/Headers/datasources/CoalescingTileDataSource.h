@@ -0,0 +1,227 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_COALESCINGTILEDATASOURCE_H_
+#define _NUTI_COALESCINGTILEDATASOURCE_H_
+
+#include "datasources/TileBatchLoader.h"
+#include "datasources/TileDataSource.h"
+
+#include <condition_variable>
+#include <exception>
+#include <unordered_map>
+#include <vector>
+
+namespace Nuti {
+
+    /**
+     * A tile data source that merges concurrent requests for the same tile. When several layers
+     * load the same tile from the shared data source at the same time, only the first request
+     * reaches the original data source and all other requests wait for its result.
+     * Each caller receives its own TileData object sharing the loaded bytes, so layers can change
+     * the max age or replace flag of their tile data independently. If the original load throws,
+     * the exception is rethrown to all waiting callers.
+     * The same instance should be given to all layers that share the original data source.
+     * Batched loads are forwarded to the original data source if it implements TileBatchLoader.
+     */
+    class CoalescingTileDataSource : public TileDataSource, public TileBatchLoader {
+    public:
+        /**
+         * Constructs a coalescing tile data source object.
+         * @param dataSource The data source whose requests will be coalesced.
+         */
+        CoalescingTileDataSource(const std::shared_ptr<TileDataSource>& dataSource);
+        virtual ~CoalescingTileDataSource();
+
+        virtual std::shared_ptr<TileData> loadTile(const MapTile& mapTile);
+
+        virtual std::vector<std::shared_ptr<TileData> > loadTiles(const std::vector<MapTile>& tiles);
+
+    protected:
+        class DataSourceListener : public TileDataSource::OnChangeListener {
+        public:
+            DataSourceListener(CoalescingTileDataSource& coalescingDataSource);
+
+            virtual void onTilesChanged(bool removeTiles);
+
+        private:
+            CoalescingTileDataSource& _coalescingDataSource;
+        };
+
+        struct PendingLoad {
+            PendingLoad();
+
+            bool _ready;
+            std::shared_ptr<TileData> _tileData;
+            std::exception_ptr _exception;
+            std::condition_variable _condition;
+        };
+
+        typedef std::unordered_map<long long, std::shared_ptr<PendingLoad> > PendingLoadMap;
+
+        std::shared_ptr<TileData> waitForLoad(const std::shared_ptr<PendingLoad>& pendingLoad, std::unique_lock<std::mutex>& lock) const;
+        void completeLoad(long long tileId, const std::shared_ptr<PendingLoad>& pendingLoad, const std::shared_ptr<TileData>& tileData, const std::exception_ptr& exception);
+
+        static std::shared_ptr<TileData> CopyTileData(const std::shared_ptr<TileData>& tileData);
+
+        std::shared_ptr<TileDataSource> _dataSource;
+
+        PendingLoadMap _pendingLoads;
+        mutable std::mutex _mutex;
+
+    private:
+        std::shared_ptr<DataSourceListener> _dataSourceListener;
+    };
+
+    inline CoalescingTileDataSource::CoalescingTileDataSource(const std::shared_ptr<TileDataSource>& dataSource) :
+        TileDataSource(dataSource->getMinZoom(), dataSource->getMaxZoom()),
+        _dataSource(dataSource),
+        _pendingLoads(),
+        _mutex(),
+        _dataSourceListener()
+    {
+        _projection = dataSource->getProjection();
+        _dataSourceListener = std::make_shared<DataSourceListener>(*this);
+        _dataSource->registerOnChangeListener(_dataSourceListener);
+    }
+
+    inline CoalescingTileDataSource::~CoalescingTileDataSource() {
+        _dataSource->unregisterOnChangeListener(_dataSourceListener);
+    }
+
+    inline std::shared_ptr<TileData> CoalescingTileDataSource::loadTile(const MapTile& mapTile) {
+        long long tileId = mapTile.getTileId();
+
+        std::shared_ptr<PendingLoad> pendingLoad;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _pendingLoads.find(tileId);
+            if (it != _pendingLoads.end()) {
+                // Identical request already in flight, wait for its result
+                return waitForLoad(it->second, lock);
+            }
+
+            pendingLoad = std::make_shared<PendingLoad>();
+            _pendingLoads[tileId] = pendingLoad;
+        }
+
+        std::shared_ptr<TileData> tileData;
+        try {
+            tileData = _dataSource->loadTile(mapTile);
+        } catch (...) {
+            completeLoad(tileId, pendingLoad, std::shared_ptr<TileData>(), std::current_exception());
+            throw;
+        }
+        completeLoad(tileId, pendingLoad, tileData, std::exception_ptr());
+        return CopyTileData(tileData);
+    }
+
+    inline std::vector<std::shared_ptr<TileData> > CoalescingTileDataSource::loadTiles(const std::vector<MapTile>& tiles) {
+        // Tiles already in flight are waited for, the rest are loaded with a single batched call
+        std::vector<std::shared_ptr<PendingLoad> > pendingLoads(tiles.size());
+        std::vector<bool> leaders(tiles.size(), false);
+        std::vector<MapTile> leaderTiles;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (std::size_t i = 0; i < tiles.size(); i++) {
+                long long tileId = tiles[i].getTileId();
+                auto it = _pendingLoads.find(tileId);
+                if (it != _pendingLoads.end()) {
+                    pendingLoads[i] = it->second;
+                    continue;
+                }
+                pendingLoads[i] = std::make_shared<PendingLoad>();
+                _pendingLoads[tileId] = pendingLoads[i];
+                leaders[i] = true;
+                leaderTiles.push_back(tiles[i]);
+            }
+        }
+
+        std::vector<std::shared_ptr<TileData> > leaderTileDatas;
+        std::exception_ptr exception;
+        if (!leaderTiles.empty()) {
+            try {
+                leaderTileDatas = TileBatchLoader::LoadTiles(*_dataSource, leaderTiles);
+            } catch (...) {
+                exception = std::current_exception();
+            }
+        }
+        for (std::size_t i = 0, j = 0; i < tiles.size(); i++) {
+            if (leaders[i]) {
+                std::shared_ptr<TileData> tileData = (j < leaderTileDatas.size() ? leaderTileDatas[j] : std::shared_ptr<TileData>());
+                completeLoad(tiles[i].getTileId(), pendingLoads[i], tileData, exception);
+                j++;
+            }
+        }
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+
+        std::vector<std::shared_ptr<TileData> > tileDatas(tiles.size());
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (std::size_t i = 0; i < tiles.size(); i++) {
+            tileDatas[i] = waitForLoad(pendingLoads[i], lock);
+        }
+        return tileDatas;
+    }
+
+    inline std::shared_ptr<TileData> CoalescingTileDataSource::waitForLoad(const std::shared_ptr<PendingLoad>& pendingLoad, std::unique_lock<std::mutex>& lock) const {
+        while (!pendingLoad->_ready) {
+            pendingLoad->_condition.wait(lock);
+        }
+        if (pendingLoad->_exception) {
+            std::rethrow_exception(pendingLoad->_exception);
+        }
+        return CopyTileData(pendingLoad->_tileData);
+    }
+
+    inline void CoalescingTileDataSource::completeLoad(long long tileId, const std::shared_ptr<PendingLoad>& pendingLoad, const std::shared_ptr<TileData>& tileData, const std::exception_ptr& exception) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _pendingLoads.find(tileId);
+        if (it != _pendingLoads.end() && it->second == pendingLoad) {
+            _pendingLoads.erase(it);
+        }
+        pendingLoad->_tileData = tileData;
+        pendingLoad->_exception = exception;
+        pendingLoad->_ready = true;
+        pendingLoad->_condition.notify_all();
+    }
+
+    inline std::shared_ptr<TileData> CoalescingTileDataSource::CopyTileData(const std::shared_ptr<TileData>& tileData) {
+        if (!tileData) {
+            return tileData;
+        }
+        auto tileDataCopy = std::make_shared<TileData>(tileData->getData());
+        tileDataCopy->setMaxAge(tileData->getMaxAge());
+        tileDataCopy->setReplaceWithParent(tileData->isReplaceWithParent());
+        return tileDataCopy;
+    }
+
+    inline CoalescingTileDataSource::DataSourceListener::DataSourceListener(CoalescingTileDataSource& coalescingDataSource) :
+        _coalescingDataSource(coalescingDataSource)
+    {
+    }
+
+    inline void CoalescingTileDataSource::DataSourceListener::onTilesChanged(bool removeTiles) {
+        {
+            // Requests made after the change must not share results of loads started before it
+            std::lock_guard<std::mutex> lock(_coalescingDataSource._mutex);
+            _coalescingDataSource._pendingLoads.clear();
+        }
+        _coalescingDataSource.notifyTilesChanged(removeTiles);
+    }
+
+    inline CoalescingTileDataSource::PendingLoad::PendingLoad() :
+        _ready(false),
+        _tileData(),
+        _exception(),
+        _condition()
+    {
+    }
+
+}
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_POOLEDMBTILESTILEDATASOURCE_H_
+#define _NUTI_POOLEDMBTILESTILEDATASOURCE_H_
+
+#include "components/Options.h"
+#include "core/MapTile.h"
+#include "core/TileData.h"
+#include "datasources/MBTilesTileDataSource.h"
+#include "datasources/TileBatchLoader.h"
+#include "datasources/TileDataSource.h"
+#include "utils/Log.h"
+#include "utils/SqliteConnectionPool.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Nuti {
+
+    /**
+     * A tile data source that loads tiles from a local MBTiles database using a pool of read-only connections.
+     * Unlike MBTilesTileDataSource, tile loads do not share a single connection and lock, so tiles can be loaded
+     * from all tile threads in parallel. Each connection caches its prepared tile query.
+     * The pool size follows the tile thread pool size of the given map options.
+     * Batched loads read the requested rows of each tile column with a single range query.
+     */
+    class PooledMBTilesTileDataSource : public TileDataSource, public TileBatchLoader {
+    public:
+        /**
+         * Constructs a PooledMBTilesTileDataSource object. TMS tile scheme is used,
+         * min and max zoom levels are automatically detected.
+         * @param path The path to the local Sqlite database file.
+         * @param options The map options, the connection pool is sized to the tile thread pool size.
+         */
+        PooledMBTilesTileDataSource(const std::string& path, const std::shared_ptr<Options>& options);
+        
+        /**
+         * Constructs a PooledMBTilesTileDataSource object with specified tile scheme.
+         * @param minZoom The minimum zoom level supported by this data source.
+         * @param maxZoom The maximum zoom level supported by this data source.
+         * @param path The path to the local Sqlite database file.
+         * @param scheme Tile scheme to use.
+         * @param options The map options, the connection pool is sized to the tile thread pool size.
+         */
+        PooledMBTilesTileDataSource(int minZoom, int maxZoom, const std::string& path, MBTilesScheme::MBTilesScheme scheme, const std::shared_ptr<Options>& options);
+        
+        virtual ~PooledMBTilesTileDataSource();
+        
+        /**
+         * Returns the maximum number of read-only database connections used for loading tiles.
+         * @return The maximum number of read-only database connections.
+         */
+        int getConnectionPoolSize() const;
+        
+        virtual std::shared_ptr<TileData> loadTile(const MapTile& mapTile);
+        
+        virtual std::vector<std::shared_ptr<TileData> > loadTiles(const std::vector<MapTile>& mapTiles);
+        
+    protected:
+        class OptionsListener : public Options::OnChangeListener {
+        public:
+            OptionsListener(PooledMBTilesTileDataSource& dataSource);
+            
+            virtual void onOptionChanged(const std::string& optionName);
+            
+        private:
+            PooledMBTilesTileDataSource& _dataSource;
+        };
+        
+        int getTileRow(const MapTile& mapTile) const;
+        
+        static void GetZoomRange(const std::string& path, int& minZoom, int& maxZoom);
+        
+        MBTilesScheme::MBTilesScheme _scheme;
+        std::string _path;
+        std::unique_ptr<SqliteConnectionPool> _connectionPool;
+        
+    private:
+        std::shared_ptr<Options> _options;
+        std::shared_ptr<OptionsListener> _optionsListener;
+    };
+    
+    inline PooledMBTilesTileDataSource::PooledMBTilesTileDataSource(const std::string& path, const std::shared_ptr<Options>& options) :
+        PooledMBTilesTileDataSource(0, 0, path, MBTilesScheme::MBTILES_SCHEME_TMS, options)
+    {
+        GetZoomRange(path, _minZoom, _maxZoom);
+    }
+    
+    inline PooledMBTilesTileDataSource::PooledMBTilesTileDataSource(int minZoom, int maxZoom, const std::string& path, MBTilesScheme::MBTilesScheme scheme, const std::shared_ptr<Options>& options) :
+        TileDataSource(minZoom, maxZoom),
+        _scheme(scheme),
+        _path(path),
+        _connectionPool(new SqliteConnectionPool(path, options ? options->getTileThreadPoolSize() : 1)),
+        _options(options),
+        _optionsListener()
+    {
+        if (_options) {
+            _optionsListener = std::make_shared<OptionsListener>(*this);
+            _options->registerOnChangeListener(_optionsListener);
+        }
+    }
+    
+    inline PooledMBTilesTileDataSource::~PooledMBTilesTileDataSource() {
+        if (_options) {
+            _options->unregisterOnChangeListener(_optionsListener);
+        }
+    }
+    
+    inline int PooledMBTilesTileDataSource::getConnectionPoolSize() const {
+        return _connectionPool->getMaxSize();
+    }
+    
+    inline std::shared_ptr<TileData> PooledMBTilesTileDataSource::loadTile(const MapTile& mapTile) {
+        SqliteConnectionPool::Lease connection = _connectionPool->acquire();
+        if (!connection) {
+            Log::Errorf("PooledMBTilesTileDataSource::loadTile: Failed to open database %s", _path.c_str());
+            return std::shared_ptr<TileData>();
+        }
+        sqlite3_stmt* stmt = connection->prepare("SELECT tile_data FROM tiles WHERE zoom_level=? AND tile_column=? AND tile_row=?");
+        if (!stmt) {
+            Log::Errorf("PooledMBTilesTileDataSource::loadTile: Failed to query tiles from %s", _path.c_str());
+            return std::shared_ptr<TileData>();
+        }
+        
+        sqlite3_bind_int(stmt, 1, mapTile.getZoom());
+        sqlite3_bind_int(stmt, 2, mapTile.getX());
+        sqlite3_bind_int(stmt, 3, getTileRow(mapTile));
+        std::shared_ptr<TileData> tileData;
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char* data = static_cast<const unsigned char*>(sqlite3_column_blob(stmt, 0));
+            int size = sqlite3_column_bytes(stmt, 0);
+            tileData = std::make_shared<TileData>(std::make_shared<std::vector<unsigned char> >(data, data + size));
+        }
+        sqlite3_reset(stmt);
+        return tileData;
+    }
+    
+    inline std::vector<std::shared_ptr<TileData> > PooledMBTilesTileDataSource::loadTiles(const std::vector<MapTile>& mapTiles) {
+        std::vector<std::shared_ptr<TileData> > tileDatas(mapTiles.size());
+        if (mapTiles.empty()) {
+            return tileDatas;
+        }
+        
+        SqliteConnectionPool::Lease connection = _connectionPool->acquire();
+        if (!connection) {
+            Log::Errorf("PooledMBTilesTileDataSource::loadTiles: Failed to open database %s", _path.c_str());
+            return tileDatas;
+        }
+        sqlite3_stmt* stmt = connection->prepare("SELECT tile_row, tile_data FROM tiles WHERE zoom_level=? AND tile_column=? AND tile_row BETWEEN ? AND ?");
+        if (!stmt) {
+            Log::Errorf("PooledMBTilesTileDataSource::loadTiles: Failed to query tiles from %s", _path.c_str());
+            return tileDatas;
+        }
+        
+        // Group the requested tiles by zoom level and column, keyed by row
+        typedef std::map<int, std::vector<std::size_t> > RowIndexMap;
+        std::map<std::pair<int, int>, RowIndexMap> columnRows;
+        for (std::size_t i = 0; i < mapTiles.size(); i++) {
+            const MapTile& mapTile = mapTiles[i];
+            columnRows[std::make_pair(mapTile.getZoom(), mapTile.getX())][getTileRow(mapTile)].push_back(i);
+        }
+        
+        // Each column is read with a single row range query. The query uses the full tiles index,
+        // so frames crossing the antimeridian do not scan the columns between the two ends of the zoom level.
+        for (auto columnIt = columnRows.begin(); columnIt != columnRows.end(); columnIt++) {
+            const RowIndexMap& rows = columnIt->second;
+            sqlite3_bind_int(stmt, 1, columnIt->first.first);
+            sqlite3_bind_int(stmt, 2, columnIt->first.second);
+            sqlite3_bind_int(stmt, 3, rows.begin()->first);
+            sqlite3_bind_int(stmt, 4, rows.rbegin()->first);
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                auto rowIt = rows.find(sqlite3_column_int(stmt, 0));
+                if (rowIt == rows.end()) {
+                    continue; // inside the range, but not requested
+                }
+                
+                const unsigned char* data = static_cast<const unsigned char*>(sqlite3_column_blob(stmt, 1));
+                int size = sqlite3_column_bytes(stmt, 1);
+                auto bytes = std::make_shared<std::vector<unsigned char> >(data, data + size);
+                for (std::size_t index : rowIt->second) {
+                    tileDatas[index] = std::make_shared<TileData>(bytes);
+                }
+            }
+            sqlite3_reset(stmt);
+        }
+        return tileDatas;
+    }
+    
+    inline int PooledMBTilesTileDataSource::getTileRow(const MapTile& mapTile) const {
+        return _scheme == MBTilesScheme::MBTILES_SCHEME_TMS ? (1 << mapTile.getZoom()) - 1 - mapTile.getY() : mapTile.getY();
+    }
+    
+    inline void PooledMBTilesTileDataSource::GetZoomRange(const std::string& path, int& minZoom, int& maxZoom) {
+        // MIN/MAX over the leading column of the tiles index are single index lookups
+        SqliteConnectionPool pool(path, 1);
+        SqliteConnectionPool::Lease connection = pool.acquire();
+        sqlite3_stmt* stmt = connection ? connection->prepare("SELECT MIN(zoom_level), MAX(zoom_level) FROM tiles") : nullptr;
+        if (!stmt || sqlite3_step(stmt) != SQLITE_ROW) {
+            Log::Errorf("PooledMBTilesTileDataSource: Failed to read zoom levels from %s", path.c_str());
+            return;
+        }
+        // Aggregates over an empty table return a single row of NULLs, keep the empty range in that case
+        if (sqlite3_column_type(stmt, 0) == SQLITE_NULL || sqlite3_column_type(stmt, 1) == SQLITE_NULL) {
+            Log::Warnf("PooledMBTilesTileDataSource: No tiles in %s", path.c_str());
+            sqlite3_reset(stmt);
+            return;
+        }
+        minZoom = sqlite3_column_int(stmt, 0);
+        maxZoom = sqlite3_column_int(stmt, 1) + 1; // exclusive, as in TileDataSource
+        sqlite3_reset(stmt);
+    }
+    
+    inline PooledMBTilesTileDataSource::OptionsListener::OptionsListener(PooledMBTilesTileDataSource& dataSource) :
+        _dataSource(dataSource)
+    {
+    }
+    
+    inline void PooledMBTilesTileDataSource::OptionsListener::onOptionChanged(const std::string& /*optionName*/) {
+        _dataSource._connectionPool->setMaxSize(_dataSource._options->getTileThreadPoolSize());
+    }
+    
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_TILEBATCHLOADER_H_
+#define _NUTI_TILEBATCHLOADER_H_
+
+#include "core/MapTile.h"
+#include "core/TileData.h"
+#include "datasources/TileDataSource.h"
+
+#include <memory>
+#include <vector>
+
+namespace Nuti {
+
+    /**
+     * Interface for tile data sources that can load multiple tiles with a single query.
+     * Data sources implement it in addition to TileDataSource, so the TileDataSource interface stays unchanged.
+     */
+    class TileBatchLoader {
+    public:
+        virtual ~TileBatchLoader() { }
+
+        /**
+         * Loads the specified tiles.
+         * @param tiles The tiles to load.
+         * @return The tile data for each requested tile, in the same order. Tiles that are not available may be null.
+         */
+        virtual std::vector<std::shared_ptr<TileData> > loadTiles(const std::vector<MapTile>& tiles) = 0;
+
+        /**
+         * Loads the specified tiles from a data source. If the data source implements TileBatchLoader,
+         * the tiles are loaded with a single call, otherwise they are loaded one by one.
+         * @param dataSource The data source to load the tiles from.
+         * @param tiles The tiles to load.
+         * @return The tile data for each requested tile, in the same order. Tiles that are not available may be null.
+         */
+        static std::vector<std::shared_ptr<TileData> > LoadTiles(TileDataSource& dataSource, const std::vector<MapTile>& tiles);
+    };
+
+    inline std::vector<std::shared_ptr<TileData> > TileBatchLoader::LoadTiles(TileDataSource& dataSource, const std::vector<MapTile>& tiles) {
+        if (TileBatchLoader* batchLoader = dynamic_cast<TileBatchLoader*>(&dataSource)) {
+            return batchLoader->loadTiles(tiles);
+        }
+
+        std::vector<std::shared_ptr<TileData> > tileDatas;
+        tileDatas.reserve(tiles.size());
+        for (const MapTile& tile : tiles) {
+            tileDatas.push_back(dataSource.loadTile(tile));
+        }
+        return tileDatas;
+    }
+
+}
+
+#endif
@@ -13,6 +13,7 @@
 #include "core/MapTile.h"
 #include "utils/LRUCache.h"
 #include "vectortiles/VectorTileDecoder.h"
+#include "vectortiles/VT/Tile.h"
 
 #include <memory>
 #include <map>
@@ -25,6 +26,7 @@ namespace Nuti {
     namespace VT {
         struct TileId;
         class Tile;
+        class Font;
     }
     
     /**
@@ -32,6 +34,19 @@ namespace Nuti {
      */
     class VectorTileLayer : public TileLayer {
     public:
+        /**
+         * Memory used by the decoded tiles of the layer, in bytes.
+         */
+        struct MemoryStatistics {
+            unsigned int tileCount;
+            std::size_t geometryBytes; // vertex and index buffers
+            std::size_t labelBytes; // label objects with their glyphs and positions
+            std::size_t fontBitmapBytes; // glyph atlases of the fonts used by the cached tiles, shared with other layers
+            std::size_t totalBytes; // allocated size of all cached tiles, see VT::Tile::getAllocatedSize
+
+            MemoryStatistics() : tileCount(0), geometryBytes(0), labelBytes(0), fontBitmapBytes(0), totalBytes(0) { }
+        };
+        
         /**
          * Constructs a VectorTileLayer object from a data source and tile decoder.
          * @param dataSource The data source from which this layer loads data.
@@ -62,6 +77,12 @@ namespace Nuti {
          * @return The new tile bitmap cache capacity in bytes.
          */
         void setTileCacheCapacity(unsigned int capacityInBytes);
+        
+        /**
+         * Calculates the memory statistics of the tiles in the visible and preloading caches.
+         * @return The memory statistics of the layer.
+         */
+        MemoryStatistics getMemoryStatistics() const;
     
         virtual void clearTileCaches(bool all);
         
@@ -125,6 +146,8 @@ namespace Nuti {
             ViewState _viewState;
         };
     
+        static void AddMemoryStatistics(const LRUCache<long long, std::shared_ptr<VT::Tile> >& cache, MemoryStatistics& stats, std::unordered_set<const VT::Font*>& fonts);
+    
         static const int CULL_DELAY_TIME = 200;
         static const int PRELOADING_PRIORITY_OFFSET = -2;
     
@@ -141,6 +164,39 @@ namespace Nuti {
         LRUCache<long long, std::shared_ptr<VT::Tile> > _preloadingCache;
     };
     
+    inline VectorTileLayer::MemoryStatistics VectorTileLayer::getMemoryStatistics() const {
+        MemoryStatistics stats;
+        std::unordered_set<const VT::Font*> fonts;
+        AddMemoryStatistics(_visibleCache, stats, fonts);
+        AddMemoryStatistics(_preloadingCache, stats, fonts);
+        for (const VT::Font* font : fonts) {
+            std::shared_ptr<VT::Bitmap> bitmap = font->getBitmap();
+            stats.fontBitmapBytes += (bitmap ? bitmap->getResidentSize() : 0);
+        }
+        return stats;
+    }
+    
+    inline void VectorTileLayer::AddMemoryStatistics(const LRUCache<long long, std::shared_ptr<VT::Tile> >& cache, MemoryStatistics& stats, std::unordered_set<const VT::Font*>& fonts) {
+        std::unordered_set<long long> tileIds = cache.getKeys();
+        for (long long tileId : tileIds) {
+            std::shared_ptr<VT::Tile> tile;
+            if (!cache.getNoMod(tileId, tile) || !tile) {
+                continue;
+            }
+            stats.tileCount++;
+            stats.geometryBytes += tile->getGeometryAllocatedSize();
+            stats.labelBytes += tile->getLabelAllocatedSize();
+            stats.totalBytes += tile->getAllocatedSize();
+            for (const std::shared_ptr<VT::TileLayer>& layer : tile->getLayers()) {
+                for (const std::shared_ptr<VT::TileLabel>& label : layer->getLabels()) {
+                    if (label->getFont()) {
+                        fonts.insert(label->getFont().get());
+                    }
+                }
+            }
+        }
+    }
+    
 }
 
 #endif
@@ -13,6 +13,7 @@
 #include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 #include <thread>
 
 #include "PackageInfo.h"
@@ -0,0 +1,390 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_SHARDEDLRUCACHE_H_
+#define _NUTI_SHARDEDLRUCACHE_H_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Nuti {
+
+    // LRU cache with the same interface as LRUCache, but split into independently locked shards.
+    // Cache hits relink the list node in place (splice) and do not allocate or copy the element.
+    // Capacity is global: the least recently used element over all shards is evicted first, as in LRUCache.
+    // Unlike LRUCache, invalidation state is kept in the elements: invalidateAll bumps a generation counter
+    // instead of walking the elements, and invalidating a key that is not cached has no effect.
+    template <typename K, typename V, typename Hash = std::hash<K> >
+    class ShardedLRUCache {
+    public:
+        ShardedLRUCache();
+        ShardedLRUCache(unsigned int capacity);
+        ShardedLRUCache(unsigned int capacity, unsigned int shardCount);
+        virtual ~ShardedLRUCache();
+
+        unsigned int getCapacity() const;
+        void setCapacity(unsigned int capacity);
+
+        unsigned int getSize() const;
+
+        bool exists(const K& id);
+        bool existsNoMod(const K& id) const;
+
+        const V get(const K& id);
+        const V getNoMod(const K& id) const;
+        bool get(const K& id, V& value);
+        bool getNoMod(const K& id, V& value) const;
+        std::unordered_set<K, Hash> getKeys() const;
+
+        void invalidate(const K& id, std::chrono::system_clock::time_point expirationTime = std::chrono::system_clock::now());
+        void invalidateAll();
+        bool isValid(const K& id) const;
+
+        void remove(const K& id);
+        void removeAll();
+
+        void store(const K& id, const V& data);
+        void store(const K& id, const V& data, unsigned int size);
+
+    private:
+        struct CacheElement {
+            CacheElement(const K& id, const V& data, unsigned int size, long long generation, unsigned long long lastAccess);
+            K _id;
+            V _data;
+            unsigned int _size;
+            unsigned long long _lastAccess; // cache-wide access counter value of the last store or hit
+            long long _generation; // element is invalid once the cache generation differs
+            std::chrono::system_clock::time_point _expirationTime; // time_point::max() if never invalidated
+        };
+
+        typedef std::list<CacheElement> CacheElementList;
+        typedef std::unordered_map<K, typename CacheElementList::iterator, Hash> CacheElementItMap;
+
+        struct Shard {
+            Shard();
+
+            CacheElementList _lruElements;
+            CacheElementItMap _mappedElements;
+
+            mutable std::mutex _mutex;
+        };
+
+        Shard& getShard(const K& id) const;
+
+        bool touch(Shard& shard, const K& id, V* value);
+        void removeOldestElements();
+
+        static const unsigned int DEFAULT_SHARD_COUNT = 8;
+
+        std::atomic<unsigned int> _capacity;
+        std::atomic<unsigned int> _size;
+        std::atomic<long long> _generation;
+        std::atomic<unsigned long long> _accessCounter;
+
+        std::unique_ptr<Shard[]> _shards;
+        unsigned int _shardCount;
+        Hash _hash;
+    };
+
+    template <typename K, typename V, typename Hash>
+    ShardedLRUCache<K, V, Hash>::ShardedLRUCache() :
+        _capacity(0),
+        _size(0),
+        _generation(0),
+        _accessCounter(0),
+        _shards(new Shard[DEFAULT_SHARD_COUNT]),
+        _shardCount(DEFAULT_SHARD_COUNT),
+        _hash()
+    {
+    }
+
+    template <typename K, typename V, typename Hash>
+    ShardedLRUCache<K, V, Hash>::ShardedLRUCache(unsigned int capacity) :
+        _capacity(capacity),
+        _size(0),
+        _generation(0),
+        _accessCounter(0),
+        _shards(new Shard[DEFAULT_SHARD_COUNT]),
+        _shardCount(DEFAULT_SHARD_COUNT),
+        _hash()
+    {
+    }
+
+    template <typename K, typename V, typename Hash>
+    ShardedLRUCache<K, V, Hash>::ShardedLRUCache(unsigned int capacity, unsigned int shardCount) :
+        _capacity(capacity),
+        _size(0),
+        _generation(0),
+        _accessCounter(0),
+        _shards(new Shard[shardCount > 0 ? shardCount : 1]),
+        _shardCount(shardCount > 0 ? shardCount : 1),
+        _hash()
+    {
+    }
+
+    template <typename K, typename V, typename Hash>
+    ShardedLRUCache<K, V, Hash>::~ShardedLRUCache() {
+    }
+
+    template <typename K, typename V, typename Hash>
+    unsigned int ShardedLRUCache<K, V, Hash>::getCapacity() const {
+        return _capacity.load();
+    }
+
+    template <typename K, typename V, typename Hash>
+    void ShardedLRUCache<K, V, Hash>::setCapacity(unsigned int capacity) {
+        _capacity.store(capacity);
+    }
+
+    template <typename K, typename V, typename Hash>
+    unsigned int ShardedLRUCache<K, V, Hash>::getSize() const {
+        return _size.load();
+    }
+
+    template <typename K, typename V, typename Hash>
+    bool ShardedLRUCache<K, V, Hash>::exists(const K& id) {
+        Shard& shard = getShard(id);
+        std::lock_guard<std::mutex> lock(shard._mutex);
+        return touch(shard, id, nullptr);
+    }
+
+    template <typename K, typename V, typename Hash>
+    bool ShardedLRUCache<K, V, Hash>::existsNoMod(const K& id) const {
+        const Shard& shard = getShard(id);
+        std::lock_guard<std::mutex> lock(shard._mutex);
+        return shard._mappedElements.find(id) != shard._mappedElements.end();
+    }
+
+    template <typename K, typename V, typename Hash>
+    const V ShardedLRUCache<K, V, Hash>::get(const K& id) {
+        V value = V();
+        get(id, value);
+        return value;
+    }
+
+    template <typename K, typename V, typename Hash>
+    const V ShardedLRUCache<K, V, Hash>::getNoMod(const K& id) const {
+        V value = V();
+        getNoMod(id, value);
+        return value;
+    }
+
+    template <typename K, typename V, typename Hash>
+    bool ShardedLRUCache<K, V, Hash>::get(const K& id, V& value) {
+        Shard& shard = getShard(id);
+        std::lock_guard<std::mutex> lock(shard._mutex);
+        return touch(shard, id, &value);
+    }
+
+    template <typename K, typename V, typename Hash>
+    bool ShardedLRUCache<K, V, Hash>::getNoMod(const K& id, V& value) const {
+        const Shard& shard = getShard(id);
+        std::lock_guard<std::mutex> lock(shard._mutex);
+
+        typename CacheElementItMap::const_iterator it = shard._mappedElements.find(id);
+        if (it == shard._mappedElements.end()) {
+            return false;
+        }
+        value = it->second->_data;
+        return true;
+    }
+
+    template <typename K, typename V, typename Hash>
+    std::unordered_set<K, Hash> ShardedLRUCache<K, V, Hash>::getKeys() const {
+        std::unordered_set<K, Hash> keys;
+        for (unsigned int i = 0; i < _shardCount; i++) {
+            const Shard& shard = _shards[i];
+            std::lock_guard<std::mutex> lock(shard._mutex);
+            for (typename CacheElementItMap::const_iterator it = shard._mappedElements.begin(); it != shard._mappedElements.end(); it++) {
+                keys.insert(it->first);
+            }
+        }
+        return keys;
+    }
+
+    template <typename K, typename V, typename Hash>
+    void ShardedLRUCache<K, V, Hash>::invalidate(const K& id, std::chrono::system_clock::time_point expirationTime) {
+        Shard& shard = getShard(id);
+        std::lock_guard<std::mutex> lock(shard._mutex);
+
+        typename CacheElementItMap::iterator it = shard._mappedElements.find(id);
+        if (it != shard._mappedElements.end()) {
+            it->second->_expirationTime = expirationTime;
+        }
+    }
+
+    template <typename K, typename V, typename Hash>
+    void ShardedLRUCache<K, V, Hash>::invalidateAll() {
+        // All existing elements become invalid, elements stored later get the new generation
+        _generation++;
+    }
+
+    template <typename K, typename V, typename Hash>
+    bool ShardedLRUCache<K, V, Hash>::isValid(const K& id) const {
+        const Shard& shard = getShard(id);
+        std::lock_guard<std::mutex> lock(shard._mutex);
+
+        typename CacheElementItMap::const_iterator it = shard._mappedElements.find(id);
+        if (it == shard._mappedElements.end()) {
+            return true;
+        }
+        const CacheElement& element = *it->second;
+        if (element._generation != _generation.load()) {
+            return false;
+        }
+        if (element._expirationTime == std::chrono::system_clock::time_point::max()) {
+            return true;
+        }
+        return element._expirationTime > std::chrono::system_clock::now();
+    }
+
+    template <typename K, typename V, typename Hash>
+    void ShardedLRUCache<K, V, Hash>::remove(const K& id) {
+        Shard& shard = getShard(id);
+        std::lock_guard<std::mutex> lock(shard._mutex);
+
+        typename CacheElementItMap::iterator it = shard._mappedElements.find(id);
+        if (it == shard._mappedElements.end()) {
+            return;
+        }
+
+        _size -= it->second->_size;
+
+        shard._lruElements.erase(it->second);
+        shard._mappedElements.erase(it);
+    }
+
+    template <typename K, typename V, typename Hash>
+    void ShardedLRUCache<K, V, Hash>::removeAll() {
+        for (unsigned int i = 0; i < _shardCount; i++) {
+            Shard& shard = _shards[i];
+            std::lock_guard<std::mutex> lock(shard._mutex);
+            for (const CacheElement& element : shard._lruElements) {
+                _size -= element._size;
+            }
+            shard._lruElements.clear();
+            shard._mappedElements.clear();
+        }
+    }
+
+    template <typename K, typename V, typename Hash>
+    void ShardedLRUCache<K, V, Hash>::store(const K& id, const V& data) {
+        store(id, data, 1);
+    }
+
+    template <typename K, typename V, typename Hash>
+    void ShardedLRUCache<K, V, Hash>::store(const K& id, const V& data, unsigned int size) {
+        Shard& shard = getShard(id);
+        {
+            std::lock_guard<std::mutex> lock(shard._mutex);
+
+            typename CacheElementItMap::iterator it = shard._mappedElements.find(id);
+            if (it != shard._mappedElements.end()) {
+                // Update the element in place and move it to the back of the list
+                CacheElement& element = *it->second;
+                _size -= element._size;
+                element._data = data;
+                element._size = size;
+                element._generation = _generation.load();
+                element._expirationTime = std::chrono::system_clock::time_point::max();
+                element._lastAccess = ++_accessCounter;
+                shard._lruElements.splice(shard._lruElements.end(), shard._lruElements, it->second);
+            } else {
+                shard._lruElements.push_back(CacheElement(id, data, size, _generation.load(), ++_accessCounter));
+                shard._mappedElements[id] = --shard._lruElements.end();
+            }
+
+            _size += size;
+        }
+
+        removeOldestElements();
+    }
+
+    template <typename K, typename V, typename Hash>
+    ShardedLRUCache<K, V, Hash>::CacheElement::CacheElement(const K& id, const V& data, unsigned int size, long long generation, unsigned long long lastAccess) :
+        _id(id),
+        _data(data),
+        _size(size),
+        _lastAccess(lastAccess),
+        _generation(generation),
+        _expirationTime(std::chrono::system_clock::time_point::max())
+    {
+    }
+
+    template <typename K, typename V, typename Hash>
+    ShardedLRUCache<K, V, Hash>::Shard::Shard() :
+        _lruElements(),
+        _mappedElements(),
+        _mutex()
+    {
+    }
+
+    template <typename K, typename V, typename Hash>
+    typename ShardedLRUCache<K, V, Hash>::Shard& ShardedLRUCache<K, V, Hash>::getShard(const K& id) const {
+        // Mix the hash, as std::hash is identity for integer keys and tile ids are highly regular
+        std::size_t hash = _hash(id);
+        hash ^= hash >> 16;
+        hash *= 0x45d9f3b;
+        hash ^= hash >> 16;
+        return _shards[hash % _shardCount];
+    }
+
+    template <typename K, typename V, typename Hash>
+    bool ShardedLRUCache<K, V, Hash>::touch(Shard& shard, const K& id, V* value) {
+        typename CacheElementItMap::const_iterator it = shard._mappedElements.find(id);
+        if (it == shard._mappedElements.end()) {
+            return false;
+        }
+
+        // Relink the existing node to the back of the list, the iterator in the map stays valid
+        it->second->_lastAccess = ++_accessCounter;
+        shard._lruElements.splice(shard._lruElements.end(), shard._lruElements, it->second);
+        if (value) {
+            *value = it->second->_data;
+        }
+        return true;
+    }
+
+    template <typename K, typename V, typename Hash>
+    void ShardedLRUCache<K, V, Hash>::removeOldestElements() {
+        // Access counter values are assigned under the shard lock, so the front of each shard list is the
+        // least recently used element of that shard. Evict the oldest of the shard fronts until within capacity.
+        while (_size.load() >= _capacity.load()) {
+            Shard* oldestShard = nullptr;
+            unsigned long long oldestAccess = 0;
+            for (unsigned int i = 0; i < _shardCount; i++) {
+                Shard& shard = _shards[i];
+                std::lock_guard<std::mutex> lock(shard._mutex);
+                if (!shard._lruElements.empty() && (!oldestShard || shard._lruElements.front()._lastAccess < oldestAccess)) {
+                    oldestShard = &shard;
+                    oldestAccess = shard._lruElements.front()._lastAccess;
+                }
+            }
+            if (!oldestShard) {
+                break;
+            }
+
+            std::lock_guard<std::mutex> lock(oldestShard->_mutex);
+            if (oldestShard->_lruElements.empty() || oldestShard->_lruElements.front()._lastAccess != oldestAccess) {
+                continue; // touched or removed concurrently, find the oldest element again
+            }
+            CacheElement& element = oldestShard->_lruElements.front();
+            _size -= element._size;
+            oldestShard->_mappedElements.erase(element._id);
+            oldestShard->_lruElements.pop_front();
+        }
+    }
+
+}
+
+#endif
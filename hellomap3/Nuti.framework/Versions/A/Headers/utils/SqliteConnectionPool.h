@@ -0,0 +1,189 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_SQLITECONNECTIONPOOL_H_
+#define _NUTI_SQLITECONNECTIONPOOL_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sqlite3.h>
+
+namespace Nuti {
+
+    // Pool of read-only connections to a single sqlite database. Connections are opened lazily, up to the
+    // maximum pool size, and each connection caches its prepared statements, so concurrent readers
+    // neither share a connection lock nor re-prepare the same query.
+    class SqliteConnectionPool {
+    public:
+        class Connection {
+        public:
+            Connection(sqlite3* db) :
+                _db(db),
+                _statements()
+            {
+            }
+
+            virtual ~Connection() {
+                for (auto it = _statements.begin(); it != _statements.end(); it++) {
+                    sqlite3_finalize(it->second);
+                }
+                sqlite3_close(_db);
+            }
+
+            sqlite3* getDatabase() const {
+                return _db;
+            }
+
+            // Returns a cached statement for the query, reset and with cleared bindings. Owned by the connection.
+            sqlite3_stmt* prepare(const std::string& sql) {
+                auto it = _statements.find(sql);
+                if (it != _statements.end()) {
+                    sqlite3_reset(it->second);
+                    sqlite3_clear_bindings(it->second);
+                    return it->second;
+                }
+
+                sqlite3_stmt* stmt = nullptr;
+                if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                    sqlite3_finalize(stmt);
+                    return nullptr;
+                }
+                _statements[sql] = stmt;
+                return stmt;
+            }
+
+        private:
+            Connection(const Connection&);
+            Connection& operator =(const Connection&);
+
+            sqlite3* _db;
+            std::unordered_map<std::string, sqlite3_stmt*> _statements;
+        };
+
+        // Scoped connection lease, the connection is returned to the pool when the lease is destroyed.
+        class Lease {
+        public:
+            Lease(SqliteConnectionPool& pool, std::unique_ptr<Connection> connection) :
+                _pool(pool),
+                _connection(std::move(connection))
+            {
+            }
+
+            Lease(Lease&& lease) :
+                _pool(lease._pool),
+                _connection(std::move(lease._connection))
+            {
+            }
+
+            ~Lease() {
+                if (_connection) {
+                    _pool.release(std::move(_connection));
+                }
+            }
+
+            Connection* operator ->() const {
+                return _connection.get();
+            }
+
+            explicit operator bool() const {
+                return _connection.get() != nullptr;
+            }
+
+        private:
+            Lease(const Lease&);
+            Lease& operator =(const Lease&);
+
+            SqliteConnectionPool& _pool;
+            std::unique_ptr<Connection> _connection;
+        };
+
+        SqliteConnectionPool(const std::string& path, int maxSize) :
+            _path(path),
+            _maxSize(maxSize > 0 ? maxSize : 1),
+            _openCount(0),
+            _idleConnections(),
+            _mutex(),
+            _condition()
+        {
+        }
+
+        virtual ~SqliteConnectionPool() {
+        }
+
+        int getMaxSize() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _maxSize;
+        }
+
+        void setMaxSize(int maxSize) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _maxSize = maxSize > 0 ? maxSize : 1;
+            while (_openCount > _maxSize && !_idleConnections.empty()) {
+                _idleConnections.pop_back();
+                _openCount--;
+            }
+            _condition.notify_all();
+        }
+
+        // Returns an idle connection, opens a new one if the pool is not full, otherwise waits until a connection is released.
+        // The returned lease is empty if the database could not be opened.
+        Lease acquire() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_idleConnections.empty() && _openCount >= _maxSize) {
+                _condition.wait(lock);
+            }
+
+            if (!_idleConnections.empty()) {
+                std::unique_ptr<Connection> connection = std::move(_idleConnections.back());
+                _idleConnections.pop_back();
+                return Lease(*this, std::move(connection));
+            }
+
+            _openCount++;
+            lock.unlock();
+
+            sqlite3* db = nullptr;
+            if (sqlite3_open_v2(_path.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+                sqlite3_close(db);
+                lock.lock();
+                _openCount--;
+                _condition.notify_one();
+                return Lease(*this, std::unique_ptr<Connection>());
+            }
+            return Lease(*this, std::unique_ptr<Connection>(new Connection(db)));
+        }
+
+    private:
+        void release(std::unique_ptr<Connection> connection) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_openCount > _maxSize) {
+                _openCount--;
+            } else {
+                _idleConnections.push_back(std::move(connection));
+            }
+            _condition.notify_one();
+        }
+
+        SqliteConnectionPool(const SqliteConnectionPool&);
+        SqliteConnectionPool& operator =(const SqliteConnectionPool&);
+
+        std::string _path;
+        int _maxSize;
+        int _openCount;
+        std::vector<std::unique_ptr<Connection> > _idleConnections;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _condition;
+    };
+
+}
+
+#endif
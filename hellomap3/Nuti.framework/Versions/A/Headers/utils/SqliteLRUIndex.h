@@ -0,0 +1,279 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_SQLITELRUINDEX_H_
+#define _NUTI_SQLITELRUINDEX_H_
+
+#include "utils/Log.h"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <sqlite3.h>
+
+namespace Nuti {
+
+    // LRU order of a sqlite table kept in the database itself instead of in memory. The table needs an integer
+    // key column, a blob column and an integer last access time column. Rows are inserted and removed through
+    // the index, so the total blob size in the meta table is updated in the same transaction as the rows.
+    // The first open of a table creates the time index and sums the blob sizes, which reads the whole table once.
+    // Later opens only read the meta row, and eviction reads only the oldest rows through the time index.
+    // Accesses are buffered and written back in a single batched update.
+    // All changes are made inside a savepoint, so the index can share a connection that is already in a transaction.
+    class SqliteLRUIndex {
+    public:
+        SqliteLRUIndex(sqlite3* db, const std::string& table, const std::string& keyColumn, const std::string& dataColumn, const std::string& timeColumn) :
+            _db(db),
+            _table(table),
+            _keyColumn(keyColumn),
+            _dataColumn(dataColumn),
+            _timeColumn(timeColumn),
+            _size(0),
+            _touchedKeys(),
+            _lastFlushTime(std::chrono::steady_clock::now()),
+            _mutex()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!beginLocked()) {
+                return;
+            }
+            long long size = 0;
+            bool ok = exec("CREATE INDEX IF NOT EXISTS " + _table + "_" + _timeColumn + " ON " + _table + "(" + _timeColumn + ")");
+            ok = ok && exec("CREATE TABLE IF NOT EXISTS " + _table + "_lru_meta(size INTEGER NOT NULL)");
+            if (ok && !queryInt("SELECT size FROM " + _table + "_lru_meta LIMIT 1", size)) {
+                ok = queryInt("SELECT IFNULL(SUM(LENGTH(" + _dataColumn + ")), 0) FROM " + _table, size);
+                ok = ok && exec("INSERT INTO " + _table + "_lru_meta(size) VALUES(" + std::to_string(size) + ")");
+            }
+            if (commitLocked(ok)) {
+                _size = size;
+            }
+        }
+
+        virtual ~SqliteLRUIndex() {
+            flushTouches();
+        }
+
+        long long getSize() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _size;
+        }
+
+        // Records an access, the access time is written together with other accesses
+        void touch(long long key) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _touchedKeys.insert(key);
+            if (_touchedKeys.size() >= MAX_TOUCH_BATCH_SIZE || std::chrono::steady_clock::now() - _lastFlushTime > std::chrono::milliseconds(MAX_TOUCH_DELAY)) {
+                flushTouchesLocked();
+            }
+        }
+
+        // Inserts or replaces a row, the row becomes the most recently used one
+        bool insert(long long key, const std::vector<unsigned char>& data) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!beginLocked()) {
+                return false;
+            }
+            long long oldSize = 0;
+            queryInt("SELECT LENGTH(" + _dataColumn + ") FROM " + _table + " WHERE " + _keyColumn + "=" + std::to_string(key), oldSize);
+
+            bool ok = false;
+            sqlite3_stmt* stmt = nullptr;
+            std::string sql = "INSERT OR REPLACE INTO " + _table + "(" + _keyColumn + ", " + _dataColumn + ", " + _timeColumn + ") VALUES(?, ?, ?)";
+            if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+                sqlite3_bind_int64(stmt, 1, key);
+                sqlite3_bind_blob(stmt, 2, data.empty() ? nullptr : &data[0], static_cast<int>(data.size()), SQLITE_STATIC);
+                sqlite3_bind_int64(stmt, 3, GetTime());
+                ok = sqlite3_step(stmt) == SQLITE_DONE;
+            }
+            sqlite3_finalize(stmt);
+
+            long long size = _size - oldSize + static_cast<long long>(data.size());
+            ok = ok && updateSizeLocked(size);
+            if (!commitLocked(ok)) {
+                return false;
+            }
+            _size = size;
+            _touchedKeys.erase(key);
+            return true;
+        }
+
+        bool remove(long long key) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!beginLocked()) {
+                return false;
+            }
+            long long oldSize = 0;
+            bool found = queryInt("SELECT LENGTH(" + _dataColumn + ") FROM " + _table + " WHERE " + _keyColumn + "=" + std::to_string(key), oldSize);
+            bool ok = !found || exec("DELETE FROM " + _table + " WHERE " + _keyColumn + "=" + std::to_string(key));
+            ok = ok && updateSizeLocked(_size - oldSize);
+            if (!commitLocked(ok)) {
+                return false;
+            }
+            _size -= oldSize;
+            _touchedKeys.erase(key);
+            return true;
+        }
+
+        bool removeAll() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!beginLocked()) {
+                return false;
+            }
+            bool ok = exec("DELETE FROM " + _table) && updateSizeLocked(0);
+            if (!commitLocked(ok)) {
+                return false;
+            }
+            _size = 0;
+            _touchedKeys.clear();
+            return true;
+        }
+
+        // Deletes least recently used rows until the total blob size is below the capacity. Returns the deleted keys.
+        // A failed query or update leaves the rows, the size and the meta row as they were.
+        std::vector<long long> evict(long long capacity) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::vector<long long> evictedKeys;
+            if (capacity <= 0) {
+                Log::Errorf("SqliteLRUIndex::evict: Invalid capacity %lld for %s", capacity, _table.c_str());
+                return evictedKeys;
+            }
+            flushTouchesLocked();
+
+            while (_size >= capacity) {
+                std::vector<std::pair<long long, long long> > rows;
+                bool queried = false;
+                sqlite3_stmt* stmt = nullptr;
+                std::string sql = "SELECT " + _keyColumn + ", LENGTH(" + _dataColumn + ") FROM " + _table + " ORDER BY " + _timeColumn + " LIMIT " + std::to_string(EVICTION_BATCH_SIZE);
+                if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+                    int result = SQLITE_DONE;
+                    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+                        rows.push_back(std::make_pair(sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1)));
+                    }
+                    queried = result == SQLITE_DONE;
+                }
+                sqlite3_finalize(stmt);
+                if (!queried) {
+                    Log::Errorf("SqliteLRUIndex::evict: Failed to query least recently used rows of %s: %s", _table.c_str(), sqlite3_errmsg(_db));
+                    break;
+                }
+
+                if (!beginLocked()) {
+                    break;
+                }
+                long long size = _size;
+                std::vector<long long> keys;
+                bool ok = true;
+                for (std::size_t i = 0; ok && i < rows.size() && size >= capacity; i++) {
+                    ok = exec("DELETE FROM " + _table + " WHERE " + _keyColumn + "=" + std::to_string(rows[i].first));
+                    keys.push_back(rows[i].first);
+                    size -= rows[i].second;
+                }
+                if (rows.empty()) {
+                    size = 0; // the table is empty, so the meta row was out of sync
+                }
+                ok = ok && updateSizeLocked(size);
+                if (!commitLocked(ok)) {
+                    break;
+                }
+                _size = size;
+                evictedKeys.insert(evictedKeys.end(), keys.begin(), keys.end());
+                if (rows.empty()) {
+                    break;
+                }
+            }
+            return evictedKeys;
+        }
+
+        void flushTouches() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            flushTouchesLocked();
+        }
+
+    private:
+        static const std::size_t MAX_TOUCH_BATCH_SIZE = 256;
+        static const int MAX_TOUCH_DELAY = 5000; // in milliseconds
+        static const int EVICTION_BATCH_SIZE = 64;
+
+        static long long GetTime() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        void flushTouchesLocked() {
+            _lastFlushTime = std::chrono::steady_clock::now();
+            if (_touchedKeys.empty()) {
+                return;
+            }
+
+            std::string keys;
+            for (long long key : _touchedKeys) {
+                keys += (keys.empty() ? "" : ",") + std::to_string(key);
+            }
+            // Failed access time updates are kept for the next flush
+            if (exec("UPDATE " + _table + " SET " + _timeColumn + "=" + std::to_string(GetTime()) + " WHERE " + _keyColumn + " IN (" + keys + ")")) {
+                _touchedKeys.clear();
+            }
+        }
+
+        bool updateSizeLocked(long long size) {
+            return exec("UPDATE " + _table + "_lru_meta SET size=" + std::to_string(size));
+        }
+
+        bool beginLocked() {
+            // Unlike BEGIN, a savepoint can be opened inside a transaction of the connection owner
+            return exec("SAVEPOINT " + _table + "_lru_index");
+        }
+
+        bool commitLocked(bool ok) {
+            std::string savepoint = _table + "_lru_index";
+            if (ok && exec("RELEASE " + savepoint)) {
+                return true;
+            }
+            exec("ROLLBACK TO " + savepoint);
+            exec("RELEASE " + savepoint);
+            return false;
+        }
+
+        bool exec(const std::string& sql) {
+            char* errorMsg = nullptr;
+            if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, &errorMsg) != SQLITE_OK) {
+                Log::Errorf("SqliteLRUIndex: Failed to execute '%s': %s", sql.c_str(), errorMsg ? errorMsg : "unknown error");
+                sqlite3_free(errorMsg);
+                return false;
+            }
+            return true;
+        }
+
+        bool queryInt(const std::string& sql, long long& value) {
+            sqlite3_stmt* stmt = nullptr;
+            bool found = false;
+            if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+                value = sqlite3_column_int64(stmt, 0);
+                found = true;
+            }
+            sqlite3_finalize(stmt);
+            return found;
+        }
+
+        sqlite3* _db;
+        std::string _table;
+        std::string _keyColumn;
+        std::string _dataColumn;
+        std::string _timeColumn;
+
+        long long _size;
+        std::unordered_set<long long> _touchedKeys;
+        std::chrono::steady_clock::time_point _lastFlushTime;
+
+        mutable std::mutex _mutex;
+    };
+
+}
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_TILEARCHIVE_H_
+#define _NUTI_TILEARCHIVE_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Nuti {
+
+    // Packed read-only tile archive. Layout (host byte order, little-endian on all supported platforms):
+    //   Header (32 bytes)
+    //   tile blobs, in the order they were added
+    //   directory: DirectoryEntry[tileCount], sorted by tile key
+    // Tile keys are the zoom level in the top 8 bits followed by the Hilbert curve index of the tile,
+    // so tiles that are close on the map are also close in the directory.
+    class TileArchive {
+    public:
+        struct Header {
+            char magic[4];
+            std::uint32_t version;
+            std::uint32_t minZoom;
+            std::uint32_t maxZoom;
+            std::uint64_t tileCount;
+            std::uint64_t directoryOffset;
+        };
+
+        struct DirectoryEntry {
+            std::uint64_t key;
+            std::uint64_t offset;
+            std::uint32_t size;
+            std::uint32_t reserved;
+
+            bool operator <(const DirectoryEntry& entry) const {
+                return key < entry.key;
+            }
+        };
+
+        static std::uint64_t CalculateTileKey(int zoom, int x, int y) {
+            std::uint64_t n = static_cast<std::uint64_t>(1) << zoom;
+            std::uint64_t rx, ry, d = 0;
+            std::uint64_t ux = static_cast<std::uint64_t>(x), uy = static_cast<std::uint64_t>(y);
+            for (std::uint64_t s = n / 2; s > 0; s /= 2) {
+                rx = (ux & s) > 0 ? 1 : 0;
+                ry = (uy & s) > 0 ? 1 : 0;
+                d += s * s * ((3 * rx) ^ ry);
+                if (ry == 0) {
+                    if (rx == 1) {
+                        ux = s - 1 - ux;
+                        uy = s - 1 - uy;
+                    }
+                    std::swap(ux, uy);
+                }
+            }
+            return (static_cast<std::uint64_t>(zoom) << 56) | d;
+        }
+
+        static std::shared_ptr<TileArchive> Open(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return std::shared_ptr<TileArchive>();
+            }
+            std::shared_ptr<TileArchive> archive(new TileArchive(fd));
+
+            off_t fileSize = ::lseek(fd, 0, SEEK_END);
+            if (fileSize < static_cast<off_t>(sizeof(Header)) || !archive->read(0, &archive->_header, sizeof(Header))) {
+                return std::shared_ptr<TileArchive>();
+            }
+            const Header& header = archive->_header;
+            if (std::memcmp(header.magic, GetMagic(), sizeof(header.magic)) != 0 || header.version != VERSION) {
+                return std::shared_ptr<TileArchive>();
+            }
+            archive->_fileSize = static_cast<std::uint64_t>(fileSize);
+            if (header.directoryOffset > archive->_fileSize || header.tileCount > (archive->_fileSize - header.directoryOffset) / sizeof(DirectoryEntry)) {
+                return std::shared_ptr<TileArchive>();
+            }
+
+            // Only the directory is kept in memory, tiles are read on demand
+            archive->_directory.resize(static_cast<std::size_t>(header.tileCount));
+            if (!archive->_directory.empty() && !archive->read(header.directoryOffset, archive->_directory.data(), archive->_directory.size() * sizeof(DirectoryEntry))) {
+                return std::shared_ptr<TileArchive>();
+            }
+            return archive;
+        }
+
+        virtual ~TileArchive() {
+            ::close(_fd);
+        }
+
+        int getMinZoom() const {
+            return static_cast<int>(_header.minZoom);
+        }
+
+        int getMaxZoom() const {
+            return static_cast<int>(_header.maxZoom);
+        }
+
+        std::size_t getTileCount() const {
+            return static_cast<std::size_t>(_header.tileCount);
+        }
+
+        // Lock-free lookup, safe to call from any number of threads. The tile is read directly into the given vector.
+        bool findTile(int zoom, int x, int y, std::vector<unsigned char>& data) const {
+            DirectoryEntry entry = DirectoryEntry();
+            entry.key = CalculateTileKey(zoom, x, y);
+            auto it = std::lower_bound(_directory.begin(), _directory.end(), entry);
+            if (it == _directory.end() || it->key != entry.key) {
+                return false;
+            }
+            if (it->offset > _fileSize || it->size > _fileSize - it->offset) {
+                return false;
+            }
+            data.resize(it->size);
+            return data.empty() || read(it->offset, data.data(), data.size());
+        }
+
+        static const char* GetMagic() {
+            return "NTAR";
+        }
+
+        static const std::uint32_t VERSION = 1;
+
+    private:
+        explicit TileArchive(int fd) :
+            _fd(fd),
+            _fileSize(0),
+            _header(),
+            _directory()
+        {
+        }
+
+        TileArchive(const TileArchive&);
+        TileArchive& operator =(const TileArchive&);
+
+        // pread does not move the file offset, so concurrent reads need no locking
+        bool read(std::uint64_t offset, void* data, std::size_t size) const {
+            unsigned char* ptr = static_cast<unsigned char*>(data);
+            while (size > 0) {
+                ssize_t count = ::pread(_fd, ptr, size, static_cast<off_t>(offset));
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0) {
+                    return false;
+                }
+                ptr += count;
+                offset += static_cast<std::uint64_t>(count);
+                size -= static_cast<std::size_t>(count);
+            }
+            return true;
+        }
+
+        int _fd;
+        std::uint64_t _fileSize;
+        Header _header;
+        std::vector<DirectoryEntry> _directory;
+    };
+
+    // Writes a tile archive. Tile blobs are streamed to the file as they are added, only the directory is kept in memory.
+    class TileArchiveWriter {
+    public:
+        TileArchiveWriter() :
+            _file(nullptr),
+            _header(),
+            _offset(0),
+            _directory()
+        {
+        }
+
+        virtual ~TileArchiveWriter() {
+            if (_file) {
+                std::fclose(_file);
+            }
+        }
+
+        bool open(const std::string& path) {
+            _file = std::fopen(path.c_str(), "wb");
+            if (!_file) {
+                return false;
+            }
+            std::memcpy(_header.magic, TileArchive::GetMagic(), sizeof(_header.magic));
+            _header.version = TileArchive::VERSION;
+            _header.minZoom = 0xffffffffu;
+            _header.maxZoom = 0;
+            _header.tileCount = 0;
+            _header.directoryOffset = 0;
+            _offset = sizeof(TileArchive::Header);
+            return std::fwrite(&_header, sizeof(_header), 1, _file) == 1;
+        }
+
+        bool addTile(int zoom, int x, int y, const unsigned char* data, std::size_t size) {
+            if (!_file) {
+                return false;
+            }
+            if (size > 0 && std::fwrite(data, 1, size, _file) != size) {
+                return false;
+            }
+
+            TileArchive::DirectoryEntry entry = TileArchive::DirectoryEntry();
+            entry.key = TileArchive::CalculateTileKey(zoom, x, y);
+            entry.offset = _offset;
+            entry.size = static_cast<std::uint32_t>(size);
+            _directory.push_back(entry);
+            _offset += size;
+
+            _header.minZoom = std::min(_header.minZoom, static_cast<std::uint32_t>(zoom));
+            _header.maxZoom = std::max(_header.maxZoom, static_cast<std::uint32_t>(zoom + 1)); // exclusive, as in TileDataSource
+            return true;
+        }
+
+        bool close() {
+            if (!_file) {
+                return false;
+            }
+
+            // Keep the directory aligned to its entry size
+            static const unsigned char padding[alignof(TileArchive::DirectoryEntry)] = { 0 };
+            std::size_t paddingSize = (alignof(TileArchive::DirectoryEntry) - _offset % alignof(TileArchive::DirectoryEntry)) % alignof(TileArchive::DirectoryEntry);
+            bool success = paddingSize == 0 || std::fwrite(padding, 1, paddingSize, _file) == paddingSize;
+            _offset += paddingSize;
+
+            // Later duplicates replace earlier ones
+            std::stable_sort(_directory.begin(), _directory.end());
+            std::vector<TileArchive::DirectoryEntry> directory;
+            directory.reserve(_directory.size());
+            for (const TileArchive::DirectoryEntry& entry : _directory) {
+                if (!directory.empty() && directory.back().key == entry.key) {
+                    directory.back() = entry;
+                } else {
+                    directory.push_back(entry);
+                }
+            }
+
+            _header.tileCount = directory.size();
+            _header.directoryOffset = _offset;
+            if (directory.empty()) {
+                _header.minZoom = 0;
+            }
+            success = success && (directory.empty() || std::fwrite(directory.data(), sizeof(TileArchive::DirectoryEntry), directory.size(), _file) == directory.size());
+            success = success && std::fseek(_file, 0, SEEK_SET) == 0;
+            success = success && std::fwrite(&_header, sizeof(_header), 1, _file) == 1;
+            success = (std::fclose(_file) == 0) && success;
+            _file = nullptr;
+            _directory.clear();
+            return success;
+        }
+
+    private:
+        TileArchiveWriter(const TileArchiveWriter&);
+        TileArchiveWriter& operator =(const TileArchiveWriter&);
+
+        std::FILE* _file;
+        TileArchive::Header _header;
+        std::uint64_t _offset;
+        std::vector<TileArchive::DirectoryEntry> _directory;
+    };
+
+}
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_TILEARCHIVEUTILS_H_
+#define _NUTI_TILEARCHIVEUTILS_H_
+
+#include "datasources/MBTilesTileDataSource.h"
+#include "packagemanager/PackageInfo.h"
+#include "packagemanager/PackageManager.h"
+#include "packagemanager/PackageTileMask.h"
+#include "utils/Log.h"
+#include "utils/TileArchive.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+namespace Nuti {
+
+    // Converters from existing offline tile stores to the packed tile archive format.
+    class TileArchiveUtils {
+    public:
+        static bool ConvertMBTiles(const std::string& mbtilesPath, const std::string& archivePath, MBTilesScheme::MBTilesScheme scheme) {
+            sqlite3* db = nullptr;
+            if (sqlite3_open_v2(mbtilesPath.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+                Log::Errorf("TileArchiveUtils::ConvertMBTiles: Failed to open database %s", mbtilesPath.c_str());
+                sqlite3_close(db);
+                return false;
+            }
+
+            TileArchiveWriter writer;
+            if (!writer.open(archivePath)) {
+                Log::Errorf("TileArchiveUtils::ConvertMBTiles: Failed to create archive %s", archivePath.c_str());
+                sqlite3_close(db);
+                return false;
+            }
+
+            // Read in zoom/column/row order, so that tile blobs of neighbouring tiles end up close to each other
+            sqlite3_stmt* stmt = nullptr;
+            bool success = sqlite3_prepare_v2(db, "SELECT zoom_level, tile_column, tile_row, tile_data FROM tiles ORDER BY zoom_level, tile_column, tile_row", -1, &stmt, nullptr) == SQLITE_OK;
+            int result = SQLITE_DONE;
+            while (success && (result = sqlite3_step(stmt)) == SQLITE_ROW) {
+                int zoom = sqlite3_column_int(stmt, 0);
+                int x = sqlite3_column_int(stmt, 1);
+                int y = sqlite3_column_int(stmt, 2);
+                if (scheme == MBTilesScheme::MBTILES_SCHEME_TMS) {
+                    y = (1 << zoom) - 1 - y;
+                }
+                const unsigned char* data = static_cast<const unsigned char*>(sqlite3_column_blob(stmt, 3));
+                int size = sqlite3_column_bytes(stmt, 3);
+                success = writer.addTile(zoom, x, y, data, static_cast<std::size_t>(size));
+            }
+            success = success && result == SQLITE_DONE;
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+
+            success = writer.close() && success;
+            if (!success) {
+                Log::Errorf("TileArchiveUtils::ConvertMBTiles: Failed to convert %s", mbtilesPath.c_str());
+            }
+            return success;
+        }
+
+        // PackageManager::loadTile reads from all installed packages. Package tile masks are quadtrees rooted at 0/0/0, so partial
+        // tiles near the root are shared by all packages and are written as loadTile resolves them. A tile that another installed
+        // package fully covers could come from that package, conversion fails in that case instead of mixing package contents.
+        static bool ConvertPackage(const PackageManager& packageManager, const std::string& packageId, int maxZoom, const std::string& archivePath) {
+            std::shared_ptr<PackageInfo> packageInfo = packageManager.getLocalPackage(packageId);
+            if (!packageInfo || !packageInfo->getTileMask()) {
+                Log::Errorf("TileArchiveUtils::ConvertPackage: Package %s not found", packageId.c_str());
+                return false;
+            }
+
+            std::vector<std::shared_ptr<PackageTileMask> > otherTileMasks;
+            for (const std::shared_ptr<PackageInfo>& otherPackageInfo : packageManager.getLocalPackages()) {
+                if (otherPackageInfo->getPackageId() != packageId && otherPackageInfo->getTileMask()) {
+                    otherTileMasks.push_back(otherPackageInfo->getTileMask());
+                }
+            }
+
+            TileArchiveWriter writer;
+            if (!writer.open(archivePath)) {
+                Log::Errorf("TileArchiveUtils::ConvertPackage: Failed to create archive %s", archivePath.c_str());
+                return false;
+            }
+
+            // Tiles are read through the package manager, which takes care of decryption and decompression
+            bool success = ConvertPackageTiles(packageManager, packageId, *packageInfo->getTileMask(), otherTileMasks, 0, 0, 0, maxZoom, writer);
+            success = writer.close() && success;
+            if (!success) {
+                Log::Errorf("TileArchiveUtils::ConvertPackage: Failed to convert package %s", packageId.c_str());
+            }
+            return success;
+        }
+
+    private:
+        static bool ConvertPackageTiles(const PackageManager& packageManager, const std::string& packageId, const PackageTileMask& tileMask, const std::vector<std::shared_ptr<PackageTileMask> >& otherTileMasks, int zoom, int x, int y, int maxZoom, TileArchiveWriter& writer) {
+            if (zoom > maxZoom || tileMask.getTileStatus(zoom, x, y) == PackageTileStatus::PACKAGE_TILE_STATUS_MISSING) {
+                return true;
+            }
+
+            for (const std::shared_ptr<PackageTileMask>& otherTileMask : otherTileMasks) {
+                if (otherTileMask->getTileStatus(zoom, x, y) == PackageTileStatus::PACKAGE_TILE_STATUS_FULL) {
+                    Log::Errorf("TileArchiveUtils::ConvertPackage: Tile %d/%d/%d of package %s is fully covered by another installed package", zoom, x, y, packageId.c_str());
+                    return false;
+                }
+            }
+
+            if (std::shared_ptr<std::vector<unsigned char> > data = packageManager.loadTile(zoom, x, y)) {
+                if (!writer.addTile(zoom, x, y, data->data(), data->size())) {
+                    return false;
+                }
+            }
+
+            for (int i = 0; i < 4; i++) {
+                if (!ConvertPackageTiles(packageManager, packageId, tileMask, otherTileMasks, zoom + 1, x * 2 + (i & 1), y * 2 + (i >> 1), maxZoom, writer)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        TileArchiveUtils();
+    };
+
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_DECODEDTILECACHE_H_
+#define _NUTI_DECODEDTILECACHE_H_
+
+#include "datasources/TileDataSource.h"
+#include "utils/ShardedLRUCache.h"
+#include "vectortiles/VectorTileDecoder.h"
+#include "vectortiles/VT/Tile.h"
+#include "vectortiles/VT/TileId.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Nuti {
+
+    // Cache of decoded vector tiles shared by vector tile layers. Layers showing the same data source with the same
+    // decoder get the same Binding from bind, and tiles are keyed by the binding id, its generation and the tile id.
+    // Binding ids are never reused, so a data source or decoder allocated at the address of a destroyed one can not
+    // hit the tiles of its predecessor. The binding listens to its data source and decoder and starts a new
+    // generation on every change, tiles of older generations are no longer returned and age out of the cache.
+    // The capacity is a byte budget based on the allocated size of the tiles.
+    class DecodedTileCache {
+    public:
+        struct Key {
+            Key(long long bindingId, long long generation, const VT::TileId& tileId) :
+                bindingId(bindingId), generation(generation), tileId(tileId) { }
+
+            long long bindingId;
+            long long generation;
+            VT::TileId tileId;
+
+            bool operator == (const Key& other) const {
+                return bindingId == other.bindingId && generation == other.generation && tileId == other.tileId;
+            }
+        };
+
+        class Binding {
+        public:
+            virtual ~Binding() {
+                if (std::shared_ptr<TileDataSource> dataSource = _dataSource.lock()) {
+                    dataSource->unregisterOnChangeListener(_dataSourceListener);
+                }
+                if (std::shared_ptr<VectorTileDecoder> decoder = _decoder.lock()) {
+                    decoder->unregisterOnChangeListener(_decoderListener);
+                }
+            }
+
+            // Returns the cache key of the tile for the current generation
+            Key getKey(const VT::TileId& tileId) const {
+                return Key(_id, _generation->load(), tileId);
+            }
+
+        private:
+            friend class DecodedTileCache;
+
+            class DataSourceListener : public TileDataSource::OnChangeListener {
+            public:
+                DataSourceListener(const std::shared_ptr<std::atomic<long long> >& generation) : _generation(generation) { }
+
+                virtual void onTilesChanged(bool /*removeTiles*/) { (*_generation)++; }
+
+            private:
+                std::shared_ptr<std::atomic<long long> > _generation;
+            };
+
+            class DecoderListener : public VectorTileDecoder::OnChangeListener {
+            public:
+                DecoderListener(const std::shared_ptr<std::atomic<long long> >& generation) : _generation(generation) { }
+
+                virtual void onDecoderChanged() { (*_generation)++; }
+
+            private:
+                std::shared_ptr<std::atomic<long long> > _generation;
+            };
+
+            Binding(long long id, const std::shared_ptr<TileDataSource>& dataSource, const std::shared_ptr<VectorTileDecoder>& decoder) :
+                _id(id),
+                _generation(std::make_shared<std::atomic<long long> >(0)),
+                _dataSource(dataSource),
+                _decoder(decoder),
+                _dataSourceListener(std::make_shared<DataSourceListener>(_generation)),
+                _decoderListener(std::make_shared<DecoderListener>(_generation))
+            {
+                dataSource->registerOnChangeListener(_dataSourceListener);
+                decoder->registerOnChangeListener(_decoderListener);
+            }
+
+            bool matches(const std::shared_ptr<TileDataSource>& dataSource, const std::shared_ptr<VectorTileDecoder>& decoder) const {
+                // Expired weak pointers never match, even if a new object reuses the address
+                return _dataSource.lock() == dataSource && _decoder.lock() == decoder;
+            }
+
+            const long long _id;
+            // Shared with the listeners, a change notification may still be running while the binding is destroyed
+            std::shared_ptr<std::atomic<long long> > _generation;
+            std::weak_ptr<TileDataSource> _dataSource;
+            std::weak_ptr<VectorTileDecoder> _decoder;
+            std::shared_ptr<DataSourceListener> _dataSourceListener;
+            std::shared_ptr<DecoderListener> _decoderListener;
+        };
+
+        DecodedTileCache(unsigned int capacity) :
+            _cache(capacity),
+            _bindings(),
+            _nextBindingId(1),
+            _mutex()
+        {
+        }
+
+        virtual ~DecodedTileCache() {
+        }
+
+        // Returns the process-wide cache instance
+        static const std::shared_ptr<DecodedTileCache>& GetSharedCache() {
+            static std::shared_ptr<DecodedTileCache> sharedCache(new DecodedTileCache(DEFAULT_CAPACITY));
+            return sharedCache;
+        }
+
+        unsigned int getCapacity() const {
+            return _cache.getCapacity();
+        }
+
+        void setCapacity(unsigned int capacityInBytes) {
+            _cache.setCapacity(capacityInBytes);
+        }
+
+        unsigned int getSize() const {
+            return _cache.getSize();
+        }
+
+        // Returns the binding of the data source and decoder, creating it if no live binding exists.
+        // Callers should keep the binding for as long as they use the pair.
+        std::shared_ptr<Binding> bind(const std::shared_ptr<TileDataSource>& dataSource, const std::shared_ptr<VectorTileDecoder>& decoder) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::shared_ptr<Binding> binding;
+            for (auto it = _bindings.begin(); it != _bindings.end(); ) {
+                std::shared_ptr<Binding> existing = it->lock();
+                if (!existing) {
+                    it = _bindings.erase(it);
+                    continue;
+                }
+                if (existing->matches(dataSource, decoder)) {
+                    binding = existing;
+                }
+                it++;
+            }
+            if (!binding) {
+                binding.reset(new Binding(_nextBindingId++, dataSource, decoder));
+                _bindings.push_back(binding);
+            }
+            return binding;
+        }
+
+        std::shared_ptr<VT::Tile> get(const Key& key) {
+            std::shared_ptr<VT::Tile> tile;
+            _cache.get(key, tile);
+            return tile;
+        }
+
+        void store(const Key& key, const std::shared_ptr<VT::Tile>& tile) {
+            if (tile) {
+                _cache.store(key, tile, static_cast<unsigned int>(tile->getAllocatedSize()));
+            }
+        }
+
+        void removeAll() {
+            _cache.removeAll();
+        }
+
+    private:
+        struct KeyHash {
+            std::size_t operator() (const Key& key) const {
+                std::size_t hash = std::hash<VT::TileId>()(key.tileId);
+                hash = hash * 31 + std::hash<long long>()(key.bindingId);
+                hash = hash * 31 + std::hash<long long>()(key.generation);
+                return hash;
+            }
+        };
+
+        static const unsigned int DEFAULT_CAPACITY = 16 * 1024 * 1024;
+
+        ShardedLRUCache<Key, std::shared_ptr<VT::Tile>, KeyHash> _cache;
+
+        std::vector<std::weak_ptr<Binding> > _bindings;
+        long long _nextBindingId;
+        mutable std::mutex _mutex;
+    };
+
+}
+
+#endif
@@ -28,6 +28,7 @@ namespace Nuti { namespace Mapnik {
 		explicit Value(long long val) : _type(Type::LONG_VALUE) { _value.p.l = val; }
 		explicit Value(double val) : _type(Type::DOUBLE_VALUE) { _value.p.d = val; }
 		explicit Value(const std::string& val) : _type(Type::STRING_VALUE) { _value.s = val; }
+		explicit Value(std::string&& val) : _type(Type::STRING_VALUE) { _value.s = std::move(val); }
 
 		Type getType() const { return _type; }
 
@@ -0,0 +1,494 @@
+/*
+ * Copyright 2014 Nutiteq Llc. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://www.nutiteq.com/license/
+ */
+
+#ifndef _NUTI_MAPNIKVT_MBVTSTREAMDECODER_H_
+#define _NUTI_MAPNIKVT_MBVTSTREAMDECODER_H_
+
+#include "FeaturesDecoder.h"
+#include "Logger.h"
+#include "Value.h"
+#include "PoolAllocator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <cglib/vec.h>
+#include <cglib/mat.h>
+#include <cglib/bbox.h>
+
+namespace Nuti { namespace MapnikVT {
+	// Mapbox vector tile decoder that reads the protobuf wire format directly instead of building the generated message objects.
+	// The tile is scanned once for layer names, key/value tables of a layer are decoded on first access and feature geometry
+	// is decoded into a caller supplied arena. forEachFeature does not allocate per feature, decodeLayer builds the
+	// usual Feature objects for existing consumers. Coordinates are normalized by the layer extent and transformed as in MBVTFeaturesDecoder.
+	// If the decoder is given a layer selection (layer names mapped to the needed attributes, null for all attributes), decodeLayer returns null
+	// for layers missing from the selection and keeps only the selected attributes, so TileReader skips unused layers without any change to its interface.
+	// The tile bytes are shared with the caller (e.g. TileData::getData) and are not copied.
+	class MBVTStreamDecoder : public FeaturesDecoder {
+		struct LayerIndex;
+
+	public:
+		using GeometryType = Mapnik::ExpressionContext::GeometryType;
+		using AttributeSet = std::unordered_set<std::string>;
+		using LayerSelection = std::unordered_map<std::string, std::shared_ptr<const AttributeSet>>;
+
+		class FeatureView {
+		public:
+			long long getId() const { return _id; }
+			GeometryType getGeometryType() const { return _geometryType; }
+
+			const cglib::vec2<float>* getVertices() const { return _vertices; }
+			std::size_t getVertexCount() const { return _vertexCount; }
+
+			// Lines and polygons consist of rings, ring i ends at vertex getRingEnds()[i]. Points have a single ring.
+			const std::size_t* getRingEnds() const { return _ringEnds; }
+			std::size_t getRingCount() const { return _ringCount; }
+
+			template <typename F>
+			void forEachTag(F func) const {
+				WireReader reader(_tags, _tagsEnd);
+				while (reader.more()) {
+					std::uint64_t keyIndex = reader.readVarint();
+					std::uint64_t valueIndex = reader.readVarint();
+					if (keyIndex < _layer->keys.size() && valueIndex < _layer->values.size()) {
+						func(_layer->keys[static_cast<std::size_t>(keyIndex)], _layer->values[static_cast<std::size_t>(valueIndex)]);
+					}
+				}
+			}
+
+		private:
+			friend class MBVTStreamDecoder;
+
+			FeatureView() : _layer(nullptr), _id(0), _geometryType(GeometryType::NULL_GEOMETRY), _vertices(nullptr), _vertexCount(0), _ringEnds(nullptr), _ringCount(0), _tags(nullptr), _tagsEnd(nullptr) { }
+
+			const LayerIndex* _layer;
+			long long _id;
+			GeometryType _geometryType;
+			const cglib::vec2<float>* _vertices;
+			std::size_t _vertexCount;
+			const std::size_t* _ringEnds;
+			std::size_t _ringCount;
+			const unsigned char* _tags;
+			const unsigned char* _tagsEnd;
+		};
+
+		MBVTStreamDecoder(const std::shared_ptr<const std::vector<unsigned char> >& data, const cglib::mat3x3<float>& transform, const std::shared_ptr<Mapnik::Logger>& logger) :
+			MBVTStreamDecoder(data, transform, logger, std::shared_ptr<const LayerSelection>())
+		{
+		}
+
+		// Null selection decodes all layers and attributes
+		MBVTStreamDecoder(const std::shared_ptr<const std::vector<unsigned char> >& data, const cglib::mat3x3<float>& transform, const std::shared_ptr<Mapnik::Logger>& logger, const std::shared_ptr<const LayerSelection>& selection) :
+			_data(data), _transform(transform), _logger(logger), _selection(selection), _clipRect(), _layers(), _layerMap()
+		{
+			_clipRect.add(cglib::transform_point(cglib::vec2<float>(0, 0), _transform));
+			_clipRect.add(cglib::transform_point(cglib::vec2<float>(1, 1), _transform));
+
+			const unsigned char* tileBegin = _data && !_data->empty() ? _data->data() : nullptr;
+			WireReader reader(tileBegin, tileBegin ? tileBegin + _data->size() : nullptr);
+			int field, wireType;
+			while (reader.next(field, wireType)) {
+				if (field == TILE_LAYERS && wireType == WIRE_LENGTH) {
+					const unsigned char* begin, *end;
+					reader.readBytes(begin, end);
+					std::unique_ptr<LayerIndex> layer(new LayerIndex(begin, end));
+					_layerMap[layer->name] = layer.get();
+					_layers.push_back(std::move(layer));
+				} else {
+					reader.skip(wireType);
+				}
+			}
+			if (reader.failed() && _logger) {
+				_logger->write(Mapnik::Logger::Severity::ERROR, "Malformed vector tile");
+			}
+		}
+
+		virtual ~MBVTStreamDecoder() = default;
+
+		virtual const cglib::bounding_box<float, 2>& getClipRect() const override { return _clipRect; }
+
+		// Calls func(const FeatureView&) for each feature of the layer. Geometry is allocated from the arena and stays valid until the arena is reset.
+		template <typename F>
+		bool forEachFeature(const std::string& name, VT::PoolAllocator& arena, F func) const {
+			const LayerIndex* layer = getLayer(name);
+			if (!layer) {
+				return false;
+			}
+
+			float scale = 1.0f / layer->extent;
+			FeatureView view;
+			view._layer = layer;
+			for (const std::pair<const unsigned char*, const unsigned char*>& feature : layer->features) {
+				if (decodeFeature(feature.first, feature.second, scale, arena, view)) {
+					func(view);
+				}
+			}
+			return true;
+		}
+
+		virtual std::shared_ptr<Features> decodeLayer(const std::string& name) const override {
+			std::shared_ptr<const AttributeSet> attributes;
+			if (_selection) {
+				auto it = _selection->find(name);
+				if (it == _selection->end()) {
+					return std::shared_ptr<Features>();
+				}
+				attributes = it->second;
+			}
+
+			VT::PoolAllocator arena;
+			auto features = std::make_shared<Features>();
+			// Features with identical tags share their user data, so the attribute values of a layer are copied once per distinct tag list
+			std::unordered_map<TagsKey, std::shared_ptr<Feature::UserData>, TagsKeyHash> userDataCache;
+			bool found = forEachFeature(name, arena, [&features, &attributes, &userDataCache](const FeatureView& view) {
+				std::shared_ptr<Feature::UserData>& userData = userDataCache[TagsKey(view._tags, view._tagsEnd)];
+				if (!userData) {
+					userData = std::make_shared<Feature::UserData>();
+					view.forEachTag([&userData, &attributes](const std::string& key, const Mapnik::Value& value) {
+						if (!attributes || attributes->count(key) > 0) {
+							(*userData)[key] = value;
+						}
+					});
+				}
+
+				if (view.getGeometryType() == GeometryType::POINT_GEOMETRY) {
+					auto vertices = std::make_shared<PointsFeature::Vertices>(view.getVertices(), view.getVertices() + view.getVertexCount());
+					features->push_back(std::make_shared<PointsFeature>(view.getId(), userData, vertices));
+					return;
+				}
+
+				auto verticesList = std::make_shared<LinesFeature::VerticesList>();
+				std::size_t ringBegin = 0;
+				for (std::size_t i = 0; i < view.getRingCount(); i++) {
+					verticesList->emplace_back(view.getVertices() + ringBegin, view.getVertices() + view.getRingEnds()[i]);
+					ringBegin = view.getRingEnds()[i];
+				}
+				if (view.getGeometryType() == GeometryType::LINE_GEOMETRY) {
+					features->push_back(std::make_shared<LinesFeature>(view.getId(), userData, verticesList));
+				} else {
+					features->push_back(std::make_shared<PolygonFeature>(view.getId(), userData, verticesList));
+				}
+			});
+			return found ? features : std::shared_ptr<Features>();
+		}
+
+	private:
+		enum { WIRE_VARINT = 0, WIRE_64BIT = 1, WIRE_LENGTH = 2, WIRE_32BIT = 5 };
+		enum { TILE_LAYERS = 3 };
+		enum { LAYER_NAME = 1, LAYER_FEATURES = 2, LAYER_KEYS = 3, LAYER_VALUES = 4, LAYER_EXTENT = 5 };
+		enum { FEATURE_ID = 1, FEATURE_TAGS = 2, FEATURE_TYPE = 3, FEATURE_GEOMETRY = 4 };
+		enum { VALUE_STRING = 1, VALUE_FLOAT = 2, VALUE_DOUBLE = 3, VALUE_INT = 4, VALUE_UINT = 5, VALUE_SINT = 6, VALUE_BOOL = 7 };
+		enum { COMMAND_MOVETO = 1, COMMAND_LINETO = 2, COMMAND_CLOSEPATH = 7 };
+
+		struct TagsKey {
+			const unsigned char* begin;
+			const unsigned char* end;
+
+			TagsKey(const unsigned char* begin, const unsigned char* end) : begin(begin), end(end) { }
+
+			bool operator == (const TagsKey& other) const {
+				return end - begin == other.end - other.begin && std::equal(begin, end, other.begin);
+			}
+		};
+
+		struct TagsKeyHash {
+			std::size_t operator() (const TagsKey& key) const {
+				std::size_t hash = 0;
+				for (const unsigned char* ptr = key.begin; ptr != key.end; ptr++) {
+					hash = hash * 31 + *ptr;
+				}
+				return hash;
+			}
+		};
+
+		class WireReader {
+		public:
+			WireReader(const unsigned char* begin, const unsigned char* end) : _ptr(begin), _end(end), _failed(false) { }
+
+			bool more() const { return _ptr < _end && !_failed; }
+			bool failed() const { return _failed; }
+
+			bool next(int& field, int& wireType) {
+				if (!more()) {
+					return false;
+				}
+				std::uint64_t key = readVarint();
+				field = static_cast<int>(key >> 3);
+				wireType = static_cast<int>(key & 7);
+				return !_failed;
+			}
+
+			std::uint64_t readVarint() {
+				std::uint64_t value = 0;
+				for (int shift = 0; shift < 64 && _ptr < _end; shift += 7) {
+					unsigned char byte = *_ptr++;
+					value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+					if (!(byte & 0x80)) {
+						return value;
+					}
+				}
+				_failed = true;
+				_ptr = _end;
+				return 0;
+			}
+
+			template <typename T>
+			T readFixed() {
+				T value = T();
+				if (_end - _ptr < static_cast<std::ptrdiff_t>(sizeof(T))) {
+					_failed = true;
+					_ptr = _end;
+					return value;
+				}
+				std::memcpy(&value, _ptr, sizeof(T)); // wire format is little endian, as are all supported platforms
+				_ptr += sizeof(T);
+				return value;
+			}
+
+			void readBytes(const unsigned char*& begin, const unsigned char*& end) {
+				std::uint64_t size = readVarint();
+				if (size > static_cast<std::uint64_t>(_end - _ptr)) {
+					_failed = true;
+					_ptr = _end;
+				}
+				begin = _ptr;
+				end = _ptr + (_failed ? 0 : size);
+				_ptr = end;
+			}
+
+			void skip(int wireType) {
+				const unsigned char* begin, *end;
+				switch (wireType) {
+				case WIRE_VARINT: readVarint(); break;
+				case WIRE_64BIT: readFixed<std::uint64_t>(); break;
+				case WIRE_LENGTH: readBytes(begin, end); break;
+				case WIRE_32BIT: readFixed<std::uint32_t>(); break;
+				default: _failed = true; _ptr = _end; break;
+				}
+			}
+
+		private:
+			const unsigned char* _ptr;
+			const unsigned char* _end;
+			bool _failed;
+		};
+
+		struct LayerIndex {
+			const unsigned char* const begin;
+			const unsigned char* const end;
+			std::string name;
+
+			// Decoded on first access
+			float extent;
+			std::vector<std::string> keys;
+			std::vector<Mapnik::Value> values;
+			std::vector<std::pair<const unsigned char*, const unsigned char*>> features;
+			std::once_flag decoded;
+
+			LayerIndex(const unsigned char* begin, const unsigned char* end) : begin(begin), end(end), name(), extent(4096), keys(), values(), features(), decoded() {
+				WireReader reader(begin, end);
+				int field, wireType;
+				while (reader.next(field, wireType)) {
+					if (field == LAYER_NAME && wireType == WIRE_LENGTH) {
+						const unsigned char* nameBegin, *nameEnd;
+						reader.readBytes(nameBegin, nameEnd);
+						name.assign(nameBegin, nameEnd);
+						break;
+					}
+					reader.skip(wireType);
+				}
+			}
+
+			void decode() {
+				WireReader reader(begin, end);
+				int field, wireType;
+				while (reader.next(field, wireType)) {
+					const unsigned char* fieldBegin, *fieldEnd;
+					if (field == LAYER_FEATURES && wireType == WIRE_LENGTH) {
+						reader.readBytes(fieldBegin, fieldEnd);
+						features.emplace_back(fieldBegin, fieldEnd);
+					} else if (field == LAYER_KEYS && wireType == WIRE_LENGTH) {
+						reader.readBytes(fieldBegin, fieldEnd);
+						keys.emplace_back(fieldBegin, fieldEnd);
+					} else if (field == LAYER_VALUES && wireType == WIRE_LENGTH) {
+						reader.readBytes(fieldBegin, fieldEnd);
+						values.push_back(DecodeValue(fieldBegin, fieldEnd));
+					} else if (field == LAYER_EXTENT && wireType == WIRE_VARINT) {
+						std::uint64_t value = reader.readVarint();
+						extent = value > 0 ? static_cast<float>(value) : 4096.0f;
+					} else {
+						reader.skip(wireType);
+					}
+				}
+			}
+		};
+
+		const LayerIndex* getLayer(const std::string& name) const {
+			auto it = _layerMap.find(name);
+			if (it == _layerMap.end()) {
+				return nullptr;
+			}
+			LayerIndex* layer = it->second;
+			std::call_once(layer->decoded, [layer]() { layer->decode(); });
+			return layer;
+		}
+
+		static Mapnik::Value DecodeValue(const unsigned char* begin, const unsigned char* end) {
+			WireReader reader(begin, end);
+			int field, wireType;
+			while (reader.next(field, wireType)) {
+				const unsigned char* stringBegin, *stringEnd;
+				switch (field) {
+				case VALUE_STRING:
+					reader.readBytes(stringBegin, stringEnd);
+					return Mapnik::Value(std::string(stringBegin, stringEnd)); // moved into the value, not copied
+				case VALUE_FLOAT:
+					return Mapnik::Value(static_cast<double>(reader.readFixed<float>()));
+				case VALUE_DOUBLE:
+					return Mapnik::Value(reader.readFixed<double>());
+				case VALUE_INT:
+				case VALUE_UINT:
+					return Mapnik::Value(static_cast<long long>(reader.readVarint()));
+				case VALUE_SINT:
+					return Mapnik::Value(DecodeZigZag(reader.readVarint()));
+				case VALUE_BOOL:
+					return Mapnik::Value(reader.readVarint() != 0);
+				default:
+					reader.skip(wireType);
+					break;
+				}
+			}
+			return Mapnik::Value();
+		}
+
+		static long long DecodeZigZag(std::uint64_t value) {
+			return static_cast<long long>(value >> 1) ^ -static_cast<long long>(value & 1);
+		}
+
+		bool decodeFeature(const unsigned char* begin, const unsigned char* end, float scale, VT::PoolAllocator& arena, FeatureView& view) const {
+			view._id = 0;
+			view._geometryType = GeometryType::NULL_GEOMETRY;
+			view._tags = view._tagsEnd = nullptr;
+			const unsigned char* geometryBegin = nullptr, *geometryEnd = nullptr;
+
+			WireReader reader(begin, end);
+			int field, wireType;
+			while (reader.next(field, wireType)) {
+				if (field == FEATURE_ID && wireType == WIRE_VARINT) {
+					view._id = static_cast<long long>(reader.readVarint());
+				} else if (field == FEATURE_TAGS && wireType == WIRE_LENGTH) {
+					reader.readBytes(view._tags, view._tagsEnd);
+				} else if (field == FEATURE_TYPE && wireType == WIRE_VARINT) {
+					std::uint64_t type = reader.readVarint();
+					view._geometryType = type <= 3 ? static_cast<GeometryType>(type) : GeometryType::NULL_GEOMETRY;
+				} else if (field == FEATURE_GEOMETRY && wireType == WIRE_LENGTH) {
+					reader.readBytes(geometryBegin, geometryEnd);
+				} else {
+					reader.skip(wireType);
+				}
+			}
+			if (reader.failed() || view._geometryType == GeometryType::NULL_GEOMETRY || !geometryBegin) {
+				return false;
+			}
+
+			// First pass validates the commands and counts vertices and rings, so that the arena allocations are exact.
+			// Lines and polygons must start each ring with MoveTo, features with LineTo or ClosePath before the first MoveTo are rejected.
+			bool points = view._geometryType == GeometryType::POINT_GEOMETRY;
+			std::size_t vertexCount = 0, ringCount = 0;
+			WireReader counter(geometryBegin, geometryEnd);
+			while (counter.more()) {
+				std::uint64_t command = counter.readVarint();
+				std::size_t count = static_cast<std::size_t>(command >> 3);
+				int commandId = static_cast<int>(command & 7);
+				if (commandId == COMMAND_MOVETO || commandId == COMMAND_LINETO) {
+					if (count > static_cast<std::size_t>(geometryEnd - geometryBegin)) {
+						return false;
+					}
+					if (commandId == COMMAND_LINETO && !points && ringCount == 0) {
+						return false;
+					}
+					vertexCount += count;
+					ringCount += (commandId == COMMAND_MOVETO ? count : 0);
+					for (std::size_t i = 0; i < count * 2; i++) {
+						counter.readVarint();
+					}
+				} else if (commandId == COMMAND_CLOSEPATH) {
+					if (!points) {
+						if (ringCount == 0) {
+							return false;
+						}
+						vertexCount++; // closing vertex, added only once per ring
+					}
+				} else {
+					return false;
+				}
+			}
+			if (counter.failed() || vertexCount == 0) {
+				return false;
+			}
+			if (points) {
+				ringCount = 1;
+			}
+
+			cglib::vec2<float>* vertices = static_cast<cglib::vec2<float>*>(arena.allocate(vertexCount * sizeof(cglib::vec2<float>)));
+			std::size_t* ringEnds = static_cast<std::size_t*>(arena.allocate(ringCount * sizeof(std::size_t)));
+			if (!vertices || !ringEnds) {
+				return false;
+			}
+
+			std::size_t vertexIndex = 0, ringIndex = 0, ringBegin = 0;
+			long long x = 0, y = 0;
+			WireReader decoder(geometryBegin, geometryEnd);
+			while (decoder.more()) {
+				std::uint64_t command = decoder.readVarint();
+				std::size_t count = static_cast<std::size_t>(command >> 3);
+				int commandId = static_cast<int>(command & 7);
+				if (commandId == COMMAND_CLOSEPATH) {
+					// Close the current ring by repeating its first vertex, unless it is already closed
+					if (!points && vertexIndex > ringBegin && vertices[vertexIndex - 1] != vertices[ringBegin]) {
+						new (&vertices[vertexIndex]) cglib::vec2<float>(vertices[ringBegin]);
+						vertexIndex++;
+					}
+					continue;
+				}
+				for (std::size_t i = 0; i < count; i++) {
+					if (commandId == COMMAND_MOVETO && !points && vertexIndex > 0) {
+						ringEnds[ringIndex++] = vertexIndex;
+						ringBegin = vertexIndex;
+					}
+					x += DecodeZigZag(decoder.readVarint());
+					y += DecodeZigZag(decoder.readVarint());
+					cglib::vec2<float> pos(static_cast<float>(x) * scale, static_cast<float>(y) * scale);
+					new (&vertices[vertexIndex++]) cglib::vec2<float>(cglib::transform_point(pos, _transform));
+				}
+			}
+			ringEnds[ringIndex++] = vertexIndex;
+
+			view._vertices = vertices;
+			view._vertexCount = vertexIndex;
+			view._ringEnds = ringEnds;
+			view._ringCount = ringIndex;
+			return true;
+		}
+
+		const std::shared_ptr<const std::vector<unsigned char> > _data;
+		const cglib::mat3x3<float> _transform;
+		const std::shared_ptr<Mapnik::Logger> _logger;
+		const std::shared_ptr<const LayerSelection> _selection;
+		cglib::bounding_box<float, 2> _clipRect;
+		std::vector<std::unique_ptr<LayerIndex>> _layers;
+		std::unordered_map<std::string, LayerIndex*> _layerMap;
+	};
+} }
+
+#endif
@@ -18,6 +18,10 @@ namespace Nuti { namespace VT {
 		const std::vector<std::uint32_t> data;
 
 		Bitmap(int width, int height, std::vector<std::uint32_t>&& data) : width(width), height(height), data(std::move(data)) { }
+
+		std::size_t getResidentSize() const {
+			return sizeof(Bitmap) + data.capacity() * sizeof(std::uint32_t);
+		}
 	};
 
 	struct BitmapPattern {
@@ -26,6 +26,19 @@ namespace Nuti { namespace VT {
 			return sizeof(TileId) + std::accumulate(_layers.begin(), _layers.end(), 0, [](std::size_t size, const std::shared_ptr<TileLayer>& layer) { return size + layer->getResidentSize(); });
 		}
 
+		// Allocated memory of the tile including reserved buffer capacity and label data, see TileLayer::getAllocatedSize
+		std::size_t getAllocatedSize() const {
+			return sizeof(Tile) + _layers.capacity() * sizeof(std::shared_ptr<TileLayer>) + std::accumulate(_layers.begin(), _layers.end(), std::size_t(0), [](std::size_t size, const std::shared_ptr<TileLayer>& layer) { return size + layer->getAllocatedSize(); });
+		}
+
+		std::size_t getGeometryAllocatedSize() const {
+			return std::accumulate(_layers.begin(), _layers.end(), std::size_t(0), [](std::size_t size, const std::shared_ptr<TileLayer>& layer) { return size + layer->getGeometryAllocatedSize(); });
+		}
+
+		std::size_t getLabelAllocatedSize() const {
+			return std::accumulate(_layers.begin(), _layers.end(), std::size_t(0), [](std::size_t size, const std::shared_ptr<TileLayer>& layer) { return size + layer->getLabelAllocatedSize(); });
+		}
+
 	private:
 		const TileId _tileId;
 		const std::vector<std::shared_ptr<TileLayer>> _layers;
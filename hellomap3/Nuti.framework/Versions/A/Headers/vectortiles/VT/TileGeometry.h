@@ -71,6 +71,10 @@ namespace Nuti { namespace VT {
 			return _vertexGeometry.size() * sizeof(unsigned char) + _indices.size() * sizeof(unsigned short);
 		}
 
+		std::size_t getAllocatedSize() const {
+			return sizeof(TileGeometry) + _vertexGeometry.getResidentSize() + _indices.getResidentSize();
+		}
+
 	private:
 		Type _type;
 		float _tileSize;
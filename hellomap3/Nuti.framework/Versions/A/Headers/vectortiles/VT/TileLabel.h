@@ -89,6 +89,18 @@ namespace Nuti { namespace VT {
 		bool calculateEnvelope(const ViewState& viewState, std::array<cglib::vec3<float>, 4>& envelope) const;
 		bool calculateVertexData(const ViewState& viewState, VertexArray<cglib::vec3<float>>& vertices, VertexArray<cglib::vec2<float>>& texCoords, VertexArray<unsigned short>& indices) const;
 
+		// Memory allocated by the label for its glyphs and position. Only data that does not change after decoding is counted,
+		// so this can be called while the culler updates placements and vertex caches. Shared fonts and bitmaps are not included.
+		std::size_t getAllocatedSize() const {
+			std::size_t size = sizeof(TileLabel) + _glyphs.capacity() * sizeof(Font::Glyph);
+			if (const VerticesList* verticesList = boost::get<VerticesList>(&_position)) {
+				for (const Vertices& vertices : *verticesList) {
+					size += sizeof(Vertices) + 2 * sizeof(void*) + vertices.capacity() * sizeof(Vertex); // list node and vertex buffer
+				}
+			}
+			return size;
+		}
+
 	private:
 		struct Placement {
 			struct Edge {
@@ -29,6 +29,20 @@ namespace Nuti { namespace VT {
 			return std::accumulate(_geometries.begin(), _geometries.end(), 0, [](std::size_t size, const std::shared_ptr<TileGeometry>& geometry) { return size + geometry->getResidentSize(); }) + _labels.size() * sizeof(TileLabel);
 		}
 
+		// Allocated memory of the layer. Unlike getResidentSize, reserved buffer capacity and the glyphs and positions of labels are included.
+		std::size_t getAllocatedSize() const {
+			std::size_t size = sizeof(TileLayer) + _geometries.capacity() * sizeof(std::shared_ptr<TileGeometry>) + _labels.capacity() * sizeof(std::shared_ptr<TileLabel>);
+			return size + getGeometryAllocatedSize() + getLabelAllocatedSize();
+		}
+
+		std::size_t getGeometryAllocatedSize() const {
+			return std::accumulate(_geometries.begin(), _geometries.end(), std::size_t(0), [](std::size_t size, const std::shared_ptr<TileGeometry>& geometry) { return size + geometry->getAllocatedSize(); });
+		}
+
+		std::size_t getLabelAllocatedSize() const {
+			return std::accumulate(_labels.begin(), _labels.end(), std::size_t(0), [](std::size_t size, const std::shared_ptr<TileLabel>& label) { return size + label->getAllocatedSize(); });
+		}
+
 	private:
 		const int _layerIdx;
 		const float _opacity;
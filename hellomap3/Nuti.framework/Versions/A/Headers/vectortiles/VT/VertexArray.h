@@ -46,6 +46,14 @@ namespace Nuti { namespace VT {
 			return _end - _begin;
 		}
 
+		std::size_t capacity() const {
+			return (_end - _begin) + _reserved;
+		}
+
+		std::size_t getResidentSize() const {
+			return capacity() * sizeof(T);
+		}
+
 		void clear() {
 			_reserved += _end - _begin;
 			_end = _begin;